@@ -26,6 +26,42 @@ static int sym_count = 0;
 /* Optional simulator name */
 char simname[MAXBUF] = "";
 
+#if !defined(VLOG) && !defined(UCLID)
+/* Generate optimized code? */
+int optimize = 0;
+
+/* Simulator source for dependency analysis (-r), or NULL */
+static char *sim_src = NULL;
+/* Report arguments and definitions the simulator does not need (-w)?
+   The reference HCL files leave some unread, so this is off by default */
+static int warn_unused = 0;
+
+/* Definitions held back for dependency analysis */
+static struct {
+    node_ptr var;
+    node_ptr expr;
+    int isbool;
+    int state;  /* 0: Not visited, 1: Being visited, 2: Live */
+} def_tab[SYM_LIM];
+static int def_count = 0;
+
+/* Which symbols are read by live definitions? */
+static int sym_used[SYM_LIM];
+
+/* Signal to specialize definitions on (-s), or NULL */
+static char *spec_name = NULL;
+/* Size of the tables indexed by its value */
+#define SPEC_VALUES 16
+/* Definitions specialized so far */
+static char *spec_defs[SYM_LIM];
+static int spec_count = 0;
+static void gen_spec_init();
+static void gen_small_asserts();
+
+static void load_sim_src(char *fname);
+static void analyze_defs();
+#endif
+
 #ifdef UCLID
 int annotate = 0;
 /* Keep list of argument names encountered in node definition */
@@ -48,7 +84,11 @@ static void usage(char *name)
     fprintf(stderr, "Usage: %s [-ah] < HCL_file  > uclid_file\n", name);
     fprintf(stderr, "   -a     Add define/use annotations\n");
 #else /* !UCLID */
-    fprintf(stderr, "Usage: %s [-h][-n NAM] < HCL_file  > C_file\n", name);
+    fprintf(stderr, "Usage: %s [-hO][-r SIM][-s SIG][-n NAM] < HCL_file  > C_file\n", name);
+    fprintf(stderr, "   -O     Optimize generated code\n");
+    fprintf(stderr, "   -r SIM Only generate definitions used by simulator source SIM\n");
+    fprintf(stderr, "   -s SIG Also generate definitions specialized on the value of SIG\n");
+    fprintf(stderr, "   -w     With -r, report arguments and definitions not used\n");
 #endif /* UCLID */
 #endif /* VLOG */
     fprintf(stderr, "   -h     Print this message\n");
@@ -66,7 +106,7 @@ void init_node(int argc, char **argv)
     int other_indents = 2;
 
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "hna")) != -1) {
+    while ((c = getopt(argc, argv, "hnaOr:s:w")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -78,6 +118,20 @@ void init_node(int argc, char **argv)
 	case 'a':
 	    annotate = 1;
 	    break;
+#endif
+#if !defined(VLOG) && !defined(UCLID)
+	case 'O':
+	    optimize = 1;
+	    break;
+	case 'r':
+	    load_sim_src(optarg);
+	    break;
+	case 's':
+	    spec_name = optarg;
+	    break;
+	case 'w':
+	    warn_unused = 1;
+	    break;
 #endif
 	default:
 	    printf("Invalid option '%c'\n", c);
@@ -120,6 +174,15 @@ static void show_node(node_ptr node)
 
 void finish_node(int check_ref)
 {
+#if !defined(VLOG) && !defined(UCLID)
+    if (sim_src)
+	analyze_defs();
+    if (spec_name)
+	gen_spec_init();
+    gen_small_asserts();
+    if (sim_src)
+	return;
+#endif
     if (check_ref) {
 	int i;
 	for (i = 0; i < sym_count; i++)
@@ -643,14 +706,848 @@ static void gen_expr(node_ptr expr)
 }
 
 
-/* Generate code defining function for var */
-void gen_funct(node_ptr var, node_ptr expr, int isbool)
+#if !defined(VLOG) && !defined(UCLID)
+/*
+ * Optimizing code generation (-O).
+ *
+ * The expressions of all definitions are built into a single DAG:
+ * variables are resolved to their quoted C text, constant
+ * subexpressions are folded while the DAG is built, and structurally
+ * equal subexpressions are hash-consed into a single node.  Within each
+ * generated function, a nonleaf node that is reached more than once is
+ * evaluated once into a local temporary.  Temporaries are emitted in
+ * topological order ahead of the return statement.
+ *
+ * Tests against small integer constants are lowered further.  A quoted
+ * name written entirely in upper case (I_NOP, REG_RSP, STAT_AOK, ...)
+ * is taken to be such a constant, as are numbers 0 to 63.  A set
+ * membership test over two or more of them becomes a shift and mask
+ * against a 64-bit constant, and a case expression whose conditions all
+ * test the same variable against them becomes a table lookup of the
+ * selected case.
+ */
+
+typedef struct DAG {
+    node_type_t type;
+    int isbool;
+    char *sval;        /* C text for var, value for num, operator for comp */
+    int nargs;
+    struct DAG **args; /* ele: value, set...  case: cond, val, cond, val... */
+    int mark;          /* Function for which uses and temp are valid */
+    int uses;          /* Number of references within that function */
+    int temp;          /* Temporary holding value, or -1 */
+    int done;          /* Function for which temporaries have been emitted */
+    int tab;           /* Lookup table for lowered case, or -1 */
+    struct DAG *chain; /* Next node in hash bucket */
+} dag_rec, *dag_ptr;
+
+#define DAG_HASH 1021
+static dag_ptr dag_tab[DAG_HASH];
+
+/* Number of functions generated so far, and temporaries and
+   lookup tables in current one */
+static int funct_cnt = 0;
+static int temp_cnt = 0;
+static int tab_cnt = 0;
+
+/* Largest constant that can be a bit position or table index */
+#define MAX_SMALL 63
+
+/* Named constants used as bit positions or table indices.  Their values
+   are only known to the C compiler, which is asked to check them */
+#define SMALL_NAMES 256
+static char *small_names[SMALL_NAMES];
+static int small_name_cnt = 0;
+
+/* While building a specialized DAG: the node standing for the signal
+   being specialized on, and the constants it is known to be compared
+   with, no two of which are equal */
+static dag_ptr spec_node = NULL;
+static dag_ptr spec_keys[SPEC_VALUES];
+static int spec_key_cnt = 0;
+
+static unsigned dag_hash(node_type_t t, char *s, int nargs, dag_ptr *args)
 {
-    if (!var || !expr) {
-	yyerror("Null node");
+    unsigned h = t;
+    int i;
+    while (*s)
+	h = h * 31 + (unsigned char) *s++;
+    for (i = 0; i < nargs; i++)
+	h = h * 31 + (unsigned) ((unsigned long) args[i] >> 4);
+    return h % DAG_HASH;
+}
+
+/* Find node with given contents in the DAG, adding it if needed */
+static dag_ptr dag_node(node_type_t t, int isbool, char *s,
+			int nargs, dag_ptr *args)
+{
+    unsigned h = dag_hash(t, s, nargs, args);
+    dag_ptr d;
+    for (d = dag_tab[h]; d; d = d->chain) {
+	if (d->type == t && d->isbool == isbool && d->nargs == nargs &&
+	    strcmp(d->sval, s) == 0 &&
+	    (nargs == 0 || memcmp(d->args, args, nargs*sizeof(dag_ptr)) == 0))
+	    return d;
+    }
+    d = malloc(sizeof(dag_rec));
+    d->type = t;
+    d->isbool = isbool;
+    d->sval = malloc(strlen(s)+1);
+    strcpy(d->sval, s);
+    d->nargs = nargs;
+    d->args = NULL;
+    if (nargs > 0) {
+	d->args = malloc(nargs*sizeof(dag_ptr));
+	memcpy(d->args, args, nargs*sizeof(dag_ptr));
+    }
+    d->mark = d->done = 0;
+    d->uses = 0;
+    d->temp = -1;
+    d->tab = -1;
+    d->chain = dag_tab[h];
+    dag_tab[h] = d;
+    return d;
+}
+
+static dag_ptr dag_num(long long val)
+{
+    char buf[32];
+    sprintf(buf, "%lld", val);
+    return dag_node(N_NUM, 0, buf, 0, NULL);
+}
+
+/* Is node a constant?  If so, get its value */
+static int dag_const(dag_ptr d, long long *valp)
+{
+    if (d->type != N_NUM)
+	return 0;
+    *valp = atoll(d->sval);
+    return 1;
+}
+
+/* Is node known to be 0 or 1?  Comparisons, set membership and ! always
+   are.  && and || become & and |, so they are when their arguments are.
+   A Boolean signal or case expression holds whatever its C code or arms
+   give, and any nonzero value counts as true */
+static int dag_normal(dag_ptr d)
+{
+    long long v;
+    if (dag_const(d, &v))
+	return v == 0 || v == 1;
+    if (d->type == N_AND || d->type == N_OR)
+	return dag_normal(d->args[0]) && dag_normal(d->args[1]);
+    return d->type == N_COMP || d->type == N_ELE || d->type == N_NOT;
+}
+
+/* Boolean node d as 0 or 1, so that folding !!x, x && 1 or x || 0 down
+   to x still gives 0 or 1 */
+static dag_ptr dag_bool(dag_ptr d)
+{
+    long long v;
+    if (dag_normal(d))
+	return d;
+    if (dag_const(d, &v))
+	return dag_num(v != 0);
+    d = dag_node(N_NOT, 1, "!", 1, &d);
+    return dag_node(N_NOT, 1, "!", 1, &d);
+}
+
+static int fold_comp(char *op, long long v1, long long v2)
+{
+    if (strcmp(op, "==") == 0)
+	return v1 == v2;
+    if (strcmp(op, "!=") == 0)
+	return v1 != v2;
+    if (strcmp(op, "<") == 0)
+	return v1 < v2;
+    if (strcmp(op, "<=") == 0)
+	return v1 <= v2;
+    if (strcmp(op, ">") == 0)
+	return v1 > v2;
+    return v1 >= v2;
+}
+
+/* When specializing, is it known whether a and b are equal?
+   Returns 1 if they are, 0 if not, and -1 if unknown */
+static int spec_equal(dag_ptr a, dag_ptr b)
+{
+    int i, ka = 0, kb = 0;
+    if (!spec_node || (a != spec_node && b != spec_node))
+	return -1;
+    if (a == b)
+	return 1;
+    for (i = 0; i < spec_key_cnt; i++) {
+	ka = ka || spec_keys[i] == a;
+	kb = kb || spec_keys[i] == b;
+    }
+    /* The signal is either one of the keys, or differs from all of them */
+    if (kb && (ka || a == spec_node))
+	return 0;
+    if (ka && b == spec_node)
+	return 0;
+    return -1;
+}
+
+/* Build DAG for expression, folding constants along the way */
+static dag_ptr build_dag(node_ptr expr)
+{
+    dag_ptr a1, a2;
+    dag_ptr *args;
+    long long v1, v2;
+    node_ptr ele;
+    int n, cnt;
+    switch(expr->type) {
+    case N_VAR:
+	{
+	    node_ptr qstring = find_symbol(expr->sval);
+	    if (!qstring) {
+		yyserror("Invalid variable '%s'", expr->sval);
+		return dag_num(0);
+	    }
+	    if (spec_node && strcmp(expr->sval, spec_name) == 0)
+		return spec_node;
+	    return dag_node(N_VAR, qstring->isbool, qstring->sval, 0, NULL);
+	}
+    case N_NUM:
+	return dag_num(atoll(expr->sval));
+    case N_NOT:
+	a1 = build_dag(expr->arg1);
+	if (dag_const(a1, &v1))
+	    return dag_num(!v1);
+	if (a1->type == N_NOT)
+	    return dag_bool(a1->args[0]);
+	return dag_node(N_NOT, 1, "!", 1, &a1);
+    case N_AND:
+    case N_OR:
+	a1 = build_dag(expr->arg1);
+	a2 = build_dag(expr->arg2);
+	if (dag_const(a1, &v1)) {
+	    if (expr->type == N_AND)
+		return dag_bool(v1 ? a2 : a1);
+	    return dag_bool(v1 ? a1 : a2);
+	}
+	if (dag_const(a2, &v2)) {
+	    if (expr->type == N_AND)
+		return dag_bool(v2 ? a1 : a2);
+	    return dag_bool(v2 ? a2 : a1);
+	}
+	if (a1 == a2)
+	    return dag_bool(a1);
+	{
+	    dag_ptr pair[2] = {a1, a2};
+	    return dag_node(expr->type, 1, expr->sval, 2, pair);
+	}
+    case N_COMP:
+	a1 = build_dag(expr->arg1);
+	a2 = build_dag(expr->arg2);
+	if (dag_const(a1, &v1) && dag_const(a2, &v2))
+	    return dag_num(fold_comp(expr->sval, v1, v2));
+	if (a1 == a2)
+	    return dag_num(fold_comp(expr->sval, 0, 0));
+	if ((strcmp(expr->sval, "==") == 0 || strcmp(expr->sval, "!=") == 0) &&
+	    (n = spec_equal(a1, a2)) >= 0)
+	    return dag_num(fold_comp(expr->sval, !n, 0));
+	{
+	    dag_ptr pair[2] = {a1, a2};
+	    return dag_node(N_COMP, 1, expr->sval, 2, pair);
+	}
+    case N_ELE:
+	for (n = 0, ele = expr->arg2; ele; ele = ele->next)
+	    n++;
+	args = malloc((n+1)*sizeof(dag_ptr));
+	a1 = args[0] = build_dag(expr->arg1);
+	cnt = 1;
+	for (ele = expr->arg2; ele; ele = ele->next) {
+	    int i;
+	    a2 = build_dag(ele);
+	    if (a2 == a1 || spec_equal(a1, a2) == 1 ||
+		(dag_const(a1, &v1) && dag_const(a2, &v2) && v1 == v2)) {
+		/* Membership certain */
+		free(args);
+		return dag_num(1);
+	    }
+	    if ((dag_const(a1, &v1) && dag_const(a2, &v2)) ||
+		spec_equal(a1, a2) == 0)
+		/* Membership impossible */
+		continue;
+	    for (i = 1; i < cnt && args[i] != a2; i++)
+		;
+	    if (i == cnt)
+		args[cnt++] = a2;
+	}
+	a2 = cnt == 1 ? dag_num(0) : dag_node(N_ELE, 1, "in", cnt, args);
+	free(args);
+	return a2;
+    case N_CASE:
+	for (n = 0, ele = expr; ele; ele = ele->next)
+	    n++;
+	args = malloc(2*n*sizeof(dag_ptr));
+	cnt = 0;
+	for (ele = expr; ele; ele = ele->next) {
+	    a1 = build_dag(ele->arg1);
+	    if (dag_const(a1, &v1) && !v1)
+		/* Case can never be selected */
+		continue;
+	    args[cnt++] = a1;
+	    args[cnt++] = build_dag(ele->arg2);
+	    if (dag_const(a1, &v1))
+		/* Default case.  Rest can never be selected */
+		break;
+	}
+	/* Cases just before default with the same value are redundant */
+	while (cnt >= 4 && dag_const(args[cnt-2], &v1) &&
+	       args[cnt-3] == args[cnt-1]) {
+	    args[cnt-4] = args[cnt-2];
+	    args[cnt-3] = args[cnt-1];
+	    cnt -= 2;
+	}
+	if (cnt == 0)
+	    a2 = dag_num(0);
+	else if (dag_const(args[0], &v1))
+	    a2 = args[1];
+	else
+	    a2 = dag_node(N_CASE, 0, ":", cnt, args);
+	free(args);
+	return a2;
+    default:
+	yyerror("Unexpected node type");
+	return dag_num(0);
+    }
+}
+
+/* Count references to nodes reachable from d in current function */
+static void dag_count_uses(dag_ptr d)
+{
+    int i;
+    if (d->mark != funct_cnt) {
+	d->mark = funct_cnt;
+	d->uses = 0;
+	d->temp = -1;
+	d->tab = -1;
+    }
+    if (d->uses++ > 0)
+	return;
+    for (i = 0; i < d->nargs; i++)
+	dag_count_uses(d->args[i]);
+}
+
+static void gen_dag(dag_ptr d);
+
+/* Is node a constant that can be used as bit position or table index? */
+static int dag_small(dag_ptr d)
+{
+    long long v;
+    char *s;
+    if (dag_const(d, &v))
+	return v >= 0 && v <= MAX_SMALL;
+    if (d->type != N_VAR || !isupper((int) d->sval[0]))
+	return 0;
+    for (s = d->sval; *s; s++)
+	if (!isupper((int) *s) && !isdigit((int) *s) && *s != '_')
+	    return 0;
+    return 1;
+}
+
+/* Is node a constant of any size? */
+static int dag_literal(dag_ptr d)
+{
+    long long v;
+    return dag_const(d, &v) || dag_small(d);
+}
+
+/* Count set elements of membership test that are small constants */
+static int ele_small_cnt(dag_ptr d)
+{
+    int i, cnt = 0;
+    for (i = 1; i < d->nargs; i++)
+	if (dag_small(d->args[i]))
+	    cnt++;
+    return cnt;
+}
+
+/* Can membership test be done with a mask? */
+static int ele_lowered(dag_ptr d)
+{
+    return d->args[0]->type == N_VAR && !dag_small(d->args[0]) &&
+	ele_small_cnt(d) >= 2;
+}
+
+/* Does condition test var against small constants only? */
+static int cond_on_var(dag_ptr c, dag_ptr var)
+{
+    if (c->type == N_ELE)
+	return c->args[0] == var && ele_small_cnt(c) == c->nargs-1;
+    if (c->type == N_COMP && strcmp(c->sval, "==") == 0)
+	return (c->args[0] == var && dag_small(c->args[1])) ||
+	    (c->args[1] == var && dag_small(c->args[0]));
+    return 0;
+}
+
+/* Can case expression be done with a table lookup?
+   If so, return the variable it selects on */
+static dag_ptr case_lowered(dag_ptr d)
+{
+    dag_ptr var = NULL;
+    dag_ptr c;
+    int i;
+    long long v;
+    int arms = d->nargs/2;
+    if (dag_const(d->args[d->nargs-2], &v))
+	/* Default case */
+	arms--;
+    if (arms < 2)
+	return NULL;
+    c = d->args[0];
+    if (c->type == N_ELE)
+	var = c->args[0];
+    else if (c->type == N_COMP)
+	var = dag_small(c->args[1]) ? c->args[0] : c->args[1];
+    if (!var || var->type != N_VAR || dag_small(var))
+	return NULL;
+    for (i = 0; i < 2*arms; i += 2)
+	if (!cond_on_var(d->args[i], var))
+	    return NULL;
+    return var;
+}
+
+/* Note that node, if a named constant, is used as bit position or index */
+static void note_small(dag_ptr d)
+{
+    int i;
+    if (d->type != N_VAR || !dag_small(d))
+	return;
+    for (i = 0; i < small_name_cnt; i++)
+	if (strcmp(small_names[i], d->sval) == 0)
+	    return;
+    if (small_name_cnt >= SMALL_NAMES) {
+	yyerror("Too many constants used as bit positions");
 	return;
     }
-    check_arg(expr, isbool);
+    small_names[small_name_cnt++] = d->sval;
+}
+
+/* Generate a check of every constant noted by note_small */
+static void gen_small_asserts()
+{
+    int i;
+    for (i = 0; i < small_name_cnt; i++) {
+	outgen_print("_Static_assert(");
+	outgen_print("(%s) >= 0 && ", small_names[i]);
+	outgen_print("(%s) <= %d, ", small_names[i], MAX_SMALL);
+	outgen_print("\"%s must be from 0 to %d\");", small_names[i],
+		     MAX_SMALL);
+	outgen_terminate();
+    }
+}
+
+/* Print single bit mask, with position given by node */
+static void gen_bit(dag_ptr d)
+{
+    note_small(d);
+    outgen_print("(1ULL << ");
+    gen_dag(d);
+    outgen_print(")");
+}
+
+/* Print test that variable can be used as bit position or index */
+static void gen_small_test(dag_ptr var)
+{
+    outgen_print("(unsigned long long) ");
+    gen_dag(var);
+    outgen_print(" <= %d", MAX_SMALL);
+}
+
+/*
+ * Emit lookup table for lowered case expression d selecting on var.
+ * Table c<n> maps each value of var to the number of the first case
+ * that tests for it (or 0 if there is none), and a<n> holds the
+ * selected case number.  When all results are constants, table v<n>
+ * maps case numbers to results.  Cases are listed in reverse, so that
+ * for any value tested by more than one case, the initializer of the
+ * first case comes last and takes precedence.
+ */
+static void gen_case_table(dag_ptr d, dag_ptr var)
+{
+    int arms = d->nargs/2;
+    int i, j;
+    int consts = 1;
+    long long v;
+    if (dag_const(d->args[d->nargs-2], &v))
+	arms--;
+    outgen_print("    static const unsigned char c%d[%d] = {",
+		 tab_cnt, MAX_SMALL+1);
+    outgen_upindent();
+    for (i = arms-1; i >= 0; i--) {
+	dag_ptr c = d->args[2*i];
+	if (c->type == N_ELE) {
+	    for (j = 1; j < c->nargs; j++) {
+		note_small(c->args[j]);
+		outgen_print(" [");
+		gen_dag(c->args[j]);
+		outgen_print("] = %d,", i+1);
+	    }
+	} else {
+	    note_small(c->args[0] == var ? c->args[1] : c->args[0]);
+	    outgen_print(" [");
+	    gen_dag(c->args[0] == var ? c->args[1] : c->args[0]);
+	    outgen_print("] = %d,", i+1);
+	}
+    }
+    outgen_print(" };");
+    outgen_downindent();
+    outgen_terminate();
+    for (i = 1; i < d->nargs; i += 2)
+	consts = consts && dag_literal(d->args[i]);
+    if (consts) {
+	outgen_print("    static const long long v%d[%d] = {", tab_cnt, arms+1);
+	outgen_upindent();
+	/* Entry 0 is value when no case is selected */
+	if (arms < d->nargs/2)
+	    gen_dag(d->args[d->nargs-1]);
+	else
+	    outgen_print("0");
+	for (i = 0; i < arms; i++) {
+	    outgen_print(", ");
+	    gen_dag(d->args[2*i+1]);
+	}
+	outgen_print(" };");
+	outgen_downindent();
+	outgen_terminate();
+    }
+    outgen_print("    int a%d = ", tab_cnt);
+    gen_small_test(var);
+    outgen_print(" ? c%d[", tab_cnt);
+    gen_dag(var);
+    outgen_print("] : 0;");
+    outgen_terminate();
+    d->tab = tab_cnt++;
+}
+
+/* Recursively generate code for DAG node */
+static void gen_dag(dag_ptr d)
+{
+    int i;
+    if (d->temp >= 0) {
+	outgen_print("t%d", d->temp);
+	return;
+    }
+    switch(d->type) {
+    case N_VAR:
+	outgen_print("(%s)", d->sval);
+	break;
+    case N_NUM:
+	outgen_print("%s", d->sval);
+	break;
+    case N_NOT:
+	outgen_print("!");
+	gen_dag(d->args[0]);
+	break;
+    case N_AND:
+    case N_OR:
+    case N_COMP:
+	outgen_print("(");
+	outgen_upindent();
+	gen_dag(d->args[0]);
+	if (d->type == N_COMP)
+	    outgen_print(" %s ", d->sval);
+	else
+	    outgen_print(d->type == N_AND ? " & " : " | ");
+	gen_dag(d->args[1]);
+	outgen_print(")");
+	outgen_downindent();
+	break;
+    case N_ELE:
+	outgen_print("(");
+	outgen_upindent();
+	if (ele_lowered(d)) {
+	    int first = 1;
+	    outgen_print("(");
+	    gen_small_test(d->args[0]);
+	    outgen_print(" && (");
+	    gen_bit(d->args[0]);
+	    outgen_print(" & (");
+	    for (i = 1; i < d->nargs; i++) {
+		if (dag_small(d->args[i])) {
+		    if (!first)
+			outgen_print(" | ");
+		    gen_bit(d->args[i]);
+		    first = 0;
+		}
+	    }
+	    outgen_print(")) != 0)");
+	    for (i = 1; i < d->nargs; i++) {
+		if (!dag_small(d->args[i])) {
+		    outgen_print(" || ");
+		    gen_dag(d->args[0]);
+		    outgen_print(" == ");
+		    gen_dag(d->args[i]);
+		}
+	    }
+	    outgen_print(")");
+	    outgen_downindent();
+	    break;
+	}
+	for (i = 1; i < d->nargs; i++) {
+	    gen_dag(d->args[0]);
+	    outgen_print(" == ");
+	    gen_dag(d->args[i]);
+	    if (i < d->nargs-1)
+		outgen_print(" || ");
+	}
+	outgen_print(")");
+	outgen_downindent();
+	break;
+    case N_CASE:
+	if (d->tab >= 0) {
+	    /* Lowered to table lookup.  See gen_case_table */
+	    int arms = d->nargs/2;
+	    int consts = 1;
+	    long long v;
+	    if (dag_const(d->args[d->nargs-2], &v))
+		arms--;
+	    for (i = 1; i < d->nargs; i += 2)
+		consts = consts && dag_literal(d->args[i]);
+	    if (consts) {
+		outgen_print("v%d[a%d]", d->tab, d->tab);
+		break;
+	    }
+	    outgen_print("(");
+	    outgen_upindent();
+	    for (i = 0; i < arms; i++) {
+		outgen_print("a%d == %d ? ", d->tab, i+1);
+		gen_dag(d->args[2*i+1]);
+		outgen_print(" : ");
+	    }
+	    if (arms < d->nargs/2)
+		gen_dag(d->args[d->nargs-1]);
+	    else
+		outgen_print("0");
+	    outgen_print(")");
+	    outgen_downindent();
+	    break;
+	}
+	{
+	    int done = 0;
+	    long long v;
+	    outgen_print("(");
+	    outgen_upindent();
+	    for (i = 0; i < d->nargs && !done; i += 2) {
+		if (dag_const(d->args[i], &v)) {
+		    gen_dag(d->args[i+1]);
+		    done = 1;
+		} else {
+		    gen_dag(d->args[i]);
+		    outgen_print(" ? ");
+		    gen_dag(d->args[i+1]);
+		    outgen_print(" : ");
+		}
+	    }
+	    if (!done)
+		outgen_print("0");
+	    outgen_print(")");
+	    outgen_downindent();
+	}
+	break;
+    default:
+	yyerror("Unknown node type");
+	break;
+    }
+}
+
+/* Emit temporaries for shared nodes reachable from d, operands first */
+static void gen_temps(dag_ptr d)
+{
+    int i;
+    if (d->done == funct_cnt)
+	return;
+    d->done = funct_cnt;
+    for (i = 0; i < d->nargs; i++)
+	gen_temps(d->args[i]);
+    if (d->type == N_CASE) {
+	dag_ptr var = case_lowered(d);
+	if (var)
+	    gen_case_table(d, var);
+    }
+    if (d->uses > 1 && d->nargs > 0) {
+	outgen_print("    long long t%d = ", temp_cnt);
+	gen_dag(d);
+	outgen_print(";");
+	outgen_terminate();
+	d->temp = temp_cnt++;
+    }
+}
+
+/* Generate optimized body of function computing DAG d */
+static void gen_dag_body(dag_ptr d)
+{
+    funct_cnt++;
+    temp_cnt = 0;
+    tab_cnt = 0;
+    dag_count_uses(d);
+    gen_temps(d);
+    outgen_print("    return ");
+    gen_dag(d);
+}
+
+/* Generate optimized body of function computing expr */
+static void gen_opt_body(node_ptr expr)
+{
+    gen_dag_body(build_dag(expr));
+}
+
+/*
+ * Specialized code generation (-s SIG).
+ *
+ * Each definition is built again for every named constant that SIG is
+ * compared with (for icode: IHALT, INOP, ...), with SIG replaced by
+ * that constant, and once more for SIG differing from all of them, so
+ * that folding removes the tests on SIG.  Different names are taken to
+ * have different values, as they do for the codes of an instruction
+ * set.  Table spec_<name>_fn gives, for each value of SIG, the function
+ * computing what is left, or NULL if that is a constant, which is then
+ * found in spec_<name>_val.  A simulator that already knows SIG can
+ * then evaluate a definition with a table lookup and at most one call.
+ * The values of the constants are only known to the C compiler, so the
+ * tables are filled in when the simulator calls spec_init().
+ */
+
+/* Add the constants that SIG, represented by var, is compared with in d */
+static void find_spec_keys(dag_ptr d, dag_ptr var)
+{
+    int i, j;
+    for (i = 0; i < d->nargs; i++) {
+	dag_ptr k = NULL;
+	if (d->type == N_ELE && d->args[0] == var && i > 0)
+	    k = d->args[i];
+	else if (d->type == N_COMP && d->args[1-i] == var &&
+		 (strcmp(d->sval, "==") == 0 || strcmp(d->sval, "!=") == 0))
+	    k = d->args[i];
+	if (k && k->type == N_VAR && dag_small(k)) {
+	    for (j = 0; j < spec_key_cnt && spec_keys[j] != k; j++)
+		;
+	    if (j == spec_key_cnt && spec_key_cnt < SPEC_VALUES)
+		spec_keys[spec_key_cnt++] = k;
+	}
+	find_spec_keys(d->args[i], var);
+    }
+}
+
+/* Generate C text for the table entries at index for root, computed by
+   function fn unless it is constant */
+static void gen_spec_entry(node_ptr var, dag_ptr root, char *fn, char *index)
+{
+    outgen_print("	spec_%s_fn[%s] = %s;", var->sval, index,
+		 dag_literal(root) ? "0" : fn);
+    outgen_terminate();
+    outgen_print("	spec_%s_val[%s] = ", var->sval, index);
+    if (dag_literal(root))
+	gen_dag(root);
+    else
+	outgen_print("0");
+    outgen_print(";");
+    outgen_terminate();
+}
+
+static void gen_spec(node_ptr var, node_ptr expr)
+{
+    node_ptr qstring = find_symbol(spec_name);
+    dag_ptr whole = build_dag(expr);
+    dag_ptr root[SPEC_VALUES+1];
+    char fn[SPEC_VALUES+1][256];
+    int n, m;
+
+    if (!qstring)
+	return;
+    if (spec_count >= SYM_LIM) {
+	yyerror("Definition limit exceeded");
+	return;
+    }
+    spec_defs[spec_count++] = var->sval;
+
+    /* Variant 0 is SIG differing from every key, and n is SIG equal to
+       key n-1 */
+    spec_node = dag_node(N_VAR, qstring->isbool, qstring->sval, 0, NULL);
+    spec_key_cnt = 0;
+    find_spec_keys(whole, spec_node);
+    for (n = 0; n <= spec_key_cnt; n++) {
+	if (n > 0)
+	    spec_node = spec_keys[n-1];
+	root[n] = build_dag(expr);
+	for (m = 0; m < n && root[m] != root[n]; m++)
+	    ;
+	if (m < n) {
+	    strcpy(fn[n], fn[m]);
+	    continue;
+	}
+	if (root[n] == whole) {
+	    snprintf(fn[n], sizeof(fn[n]), "gen_%s", var->sval);
+	    continue;
+	}
+	snprintf(fn[n], sizeof(fn[n]), "spec_%s_%d", var->sval, n);
+	if (dag_literal(root[n]))
+	    continue;
+	outgen_print("static long long %s()", fn[n]);
+	outgen_terminate();
+	outgen_print("{");
+	outgen_terminate();
+	gen_dag_body(root[n]);
+	outgen_print(";");
+	outgen_terminate();
+	outgen_print("}");
+	outgen_terminate();
+	outgen_terminate();
+    }
+    spec_node = NULL;
+
+    outgen_print("long long (*spec_%s_fn[%d])();", var->sval, SPEC_VALUES);
+    outgen_terminate();
+    outgen_print("long long spec_%s_val[%d];", var->sval, SPEC_VALUES);
+    outgen_terminate();
+    outgen_terminate();
+    outgen_print("static void spec_init_%s()", var->sval);
+    outgen_terminate();
+    outgen_print("{");
+    outgen_terminate();
+    outgen_print("    int v;");
+    outgen_terminate();
+    outgen_print("    for (v = 0; v < %d; v++) {", SPEC_VALUES);
+    outgen_terminate();
+    gen_spec_entry(var, root[0], fn[0], "v");
+    outgen_print("    }");
+    outgen_terminate();
+    for (n = 1; n <= spec_key_cnt; n++) {
+	outgen_print("    if ((unsigned long long) (%s) < %d) {",
+		     spec_keys[n-1]->sval, SPEC_VALUES);
+	outgen_terminate();
+	gen_spec_entry(var, root[n], fn[n], spec_keys[n-1]->sval);
+	outgen_print("    }");
+	outgen_terminate();
+    }
+    outgen_print("}");
+    outgen_terminate();
+    outgen_terminate();
+}
+
+/* Generate function filling in the tables of every specialized definition */
+static void gen_spec_init()
+{
+    int i;
+    outgen_print("void spec_init()");
+    outgen_terminate();
+    outgen_print("{");
+    outgen_terminate();
+    for (i = 0; i < spec_count; i++) {
+	outgen_print("    spec_init_%s();", spec_defs[i]);
+	outgen_terminate();
+    }
+    outgen_print("}");
+    outgen_terminate();
+}
+#endif /* !VLOG && !UCLID */
+
+/* Generate code defining function for var */
+static void emit_funct(node_ptr var, node_ptr expr, int isbool)
+{
 #ifdef VLOG
     outgen_print("assign %s = ", var->sval);
     outgen_terminate();
@@ -691,13 +1588,180 @@ void gen_funct(node_ptr var, node_ptr expr, int isbool)
     outgen_terminate();
     outgen_print("{");
     outgen_terminate();
-    outgen_print("    return ");
-    gen_expr(expr);
+    if (optimize)
+	gen_opt_body(expr);
+    else {
+	outgen_print("    return ");
+	gen_expr(expr);
+    }
     outgen_print(";");
     outgen_terminate();
     outgen_print("}");
     outgen_terminate();
     outgen_terminate();
+    if (spec_name)
+	gen_spec(var, expr);
 #endif /* UCLID */
 #endif /* VLOG */
 }
+
+void gen_funct(node_ptr var, node_ptr expr, int isbool)
+{
+    if (!var || !expr) {
+	yyerror("Null node");
+	return;
+    }
+    check_arg(expr, isbool);
+#if !defined(VLOG) && !defined(UCLID)
+    if (sim_src) {
+	/* Hold back until all definitions have been read */
+	if (def_count >= SYM_LIM) {
+	    yyerror("Definition limit exceeded");
+	    return;
+	}
+	def_tab[def_count].var = var;
+	def_tab[def_count].expr = expr;
+	def_tab[def_count].isbool = isbool;
+	def_tab[def_count].state = 0;
+	def_count++;
+	return;
+    }
+#endif
+    emit_funct(var, expr, isbool);
+}
+
+#if !defined(VLOG) && !defined(UCLID)
+/*
+ * Dependency analysis (-r).
+ *
+ * Definitions form a graph through the signals they read: a signal with
+ * the same name as a definition (f_icode, d_srcA, instr_valid, ...)
+ * holds the value the simulator computed with that definition's gen_
+ * function.  Starting from the definitions whose gen_ function appears
+ * in the simulator source, every definition that feeds them is live.
+ * Definitions that are not live are reported and not generated, along
+ * with declared signals that no live definition reads, and definitions
+ * that depend on their own value.
+ */
+
+/* Read simulator source into memory */
+static void load_sim_src(char *fname)
+{
+    FILE *fp = fopen(fname, "r");
+    long len;
+    if (!fp) {
+	fprintf(stderr, "Can't open simulator source '%s'\n", fname);
+	exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    rewind(fp);
+    sim_src = malloc(len+1);
+    len = fread(sim_src, 1, len, fp);
+    sim_src[len] = '\0';
+    fclose(fp);
+}
+
+static int is_ident_char(int c)
+{
+    return isalnum(c) || c == '_';
+}
+
+/* Does the simulator source refer to gen_name? */
+static int sim_refers(char *name)
+{
+    char *p = sim_src;
+    int len = strlen(name);
+    while ((p = strstr(p, "gen_")) != NULL) {
+	int inside = p > sim_src && is_ident_char((unsigned char) p[-1]);
+	p += 4;
+	if (!inside && strncmp(p, name, len) == 0 &&
+	    !is_ident_char((unsigned char) p[len]))
+	    return 1;
+    }
+    return 0;
+}
+
+static int find_def(char *name)
+{
+    int i;
+    for (i = 0; i < def_count; i++)
+	if (strcmp(name, def_tab[i].var->sval) == 0)
+	    return i;
+    return -1;
+}
+
+static void mark_live(int d);
+
+/* Mark signals read by expression, and the definitions behind them */
+static void mark_expr(node_ptr expr)
+{
+    node_ptr ele;
+    int i;
+    switch(expr->type) {
+    case N_VAR:
+	for (i = 0; i < sym_count; i++)
+	    if (strcmp(expr->sval, sym_tab[0][i]->sval) == 0)
+		sym_used[i] = 1;
+	if ((i = find_def(expr->sval)) >= 0)
+	    mark_live(i);
+	break;
+    case N_NOT:
+	mark_expr(expr->arg1);
+	break;
+    case N_AND:
+    case N_OR:
+    case N_COMP:
+	mark_expr(expr->arg1);
+	mark_expr(expr->arg2);
+	break;
+    case N_ELE:
+	mark_expr(expr->arg1);
+	for (ele = expr->arg2; ele; ele = ele->next)
+	    mark_expr(ele);
+	break;
+    case N_CASE:
+	for (ele = expr; ele; ele = ele->next) {
+	    mark_expr(ele->arg1);
+	    mark_expr(ele->arg2);
+	}
+	break;
+    default:
+	break;
+    }
+}
+
+static void mark_live(int d)
+{
+    if (def_tab[d].state == 2)
+	return;
+    if (def_tab[d].state == 1) {
+	fprintf(stderr, "Warning, definition '%s' depends on its own value\n",
+		def_tab[d].var->sval);
+	return;
+    }
+    def_tab[d].state = 1;
+    mark_expr(def_tab[d].expr);
+    def_tab[d].state = 2;
+}
+
+/* Find live definitions, report problems, and generate live ones */
+static void analyze_defs()
+{
+    int i;
+    for (i = 0; i < def_count; i++)
+	if (sim_refers(def_tab[i].var->sval))
+	    mark_live(i);
+    for (i = 0; i < sym_count; i++)
+	if (!sym_used[i] && warn_unused)
+	    fprintf(stderr, "Warning, argument '%s' not referenced\n",
+		    sym_tab[0][i]->sval);
+    for (i = 0; i < def_count; i++) {
+	if (def_tab[i].state == 2)
+	    emit_funct(def_tab[i].var, def_tab[i].expr, def_tab[i].isbool);
+	else if (warn_unused)
+	    fprintf(stderr, "Warning, definition '%s' not used by simulator\n",
+		    def_tab[i].var->sval);
+    }
+}
+#endif /* !VLOG && !UCLID */
@@ -7,10 +7,43 @@
 #include "yas.h"
 #include "isa.h"
 
-void add_symbol(char *, int);
-int find_symbol(char *);
+/* Symbols.  Each identifier is interned as a symbol when the lexer
+   first sees it, so tokens carry a pointer to their symbol and no
+   lookup by name is needed after that */
+typedef struct sym_rec {
+    char *name;
+    int pos;                    /* Address, once defined */
+    int defined;
+    int fixups;                 /* First unresolved reference, or -1 */
+    struct sym_rec *next;       /* Next symbol in the same hash bucket */
+} sym_rec, *sym_ptr;
+
+sym_ptr intern(char *);
+void add_symbol(sym_ptr, int);
+word_t find_symbol(sym_ptr, int, int);
+void place_fixups();
+static void print_errors();
 int instr_size(char *);
 
+/* References to labels not yet defined when assembling in one pass.
+   While its line is being assembled, a fixup records where its value
+   goes in the instruction.  Once the line is printed, it records where
+   the hex digits of the value are in outbuf */
+typedef struct {
+    sym_ptr sym;
+    int next;           /* Next fixup for the same symbol, or -1 */
+    int codepos;        /* Offset of the value in the instruction */
+    int bytes;          /* Size of the value */
+    int bufpos;         /* Offset of its hex digits in outbuf, or -1 */
+    int lineno;         /* Line and address, for error messages */
+    int bytepos;
+} fixup_rec;
+
+static fixup_rec *fixups = NULL;
+static int nfixups = 0;
+static int fixcap = 0;
+static int line_fixups = 0; /* First fixup of the current line */
+
 int gui_mode = 0;
 
 FILE *outfile;
@@ -26,8 +59,16 @@ int lineno = 1; /* Line number of input file */
 int bytepos = 0; /* Address of current instruction being processed */
 int error_mode = 0; /* Am I trying to finish off a line with an error? */
 int hit_error = 0; /* Have I hit any errors? */
+/* Am I working on the operands of an instruction, which pass 1 skips? */
+int in_operands = 0;
+/* Have I hit an error that pass 1 would catch?  With two passes, that
+   ends the run before any output is written */
+int pass1_error = 0;
 
 int pass = 1; /* Am I in pass 1 or 2? */
+/* Assemble in a single pass, patching forward references into the
+   buffered output once their labels are defined? */
+int one_pass = 1;
 
 /* General strategy is to read tokens for a complete line and then
    process them.
@@ -43,6 +84,7 @@ typedef struct {
     char *sval; /* String    */
     word_t ival;   /* Integer   */
     char cval;  /* Character */
+    sym_ptr sym; /* Symbol, for identifiers */
     token_t type; /* Type    */
 } token_rec, *token_ptr;
 
@@ -130,6 +172,29 @@ static void hexstuff(char *dest, word_t value, int len)
     }
 }
 
+/* Output of the single pass, held back until every label is known */
+char *outbuf = NULL;
+int outlen = 0;
+int outcap = 0;
+int line_start = 0; /* Where the last line printed begins in outbuf */
+
+void out_append(char *s)
+{
+    int len = strlen(s);
+    if (outlen + len > outcap) {
+	outcap = outcap ? 2 * outcap : 65536;
+	while (outlen + len > outcap)
+	    outcap *= 2;
+	outbuf = (char *) realloc(outbuf, outcap);
+	if (!outbuf) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+    }
+    memcpy(outbuf + outlen, s, len);
+    outlen += len;
+}
+
 void print_code(FILE *out, int pos)
 {
     char outstring[33];
@@ -143,6 +208,7 @@ void print_code(FILE *out, int pos)
 	    int i;
 	    if (pos > 0xFFFF) {
 		fail("Code address limit exceeded");
+		print_errors();
 		exit(1);
 	    }
 	    strcpy(outstring, "0x0000:                      | ");
@@ -162,6 +228,7 @@ void print_code(FILE *out, int pos)
 	    int i;
 	    if (pos > 0xFFF) {
 		fail("Code address limit exceeded");
+		print_errors();
 		exit(1);
 	    }
 	    strcpy(outstring, "0x000:                      | ");
@@ -184,20 +251,97 @@ void print_code(FILE *out, int pos)
 	    }
 	}
       }
+    } else if (one_pass) {
+      line_start = outlen;
+      out_append(outstring);
+      out_append(input_line);
+      out_append("\n");
     } else {
       fprintf(out, "%s%s\n", outstring, input_line);
     }
 }
 
+/* Errors of the single pass.  Unresolved labels are only found at the
+   end, so the errors are held back and printed in line order, keeping
+   the first error of each line, as the two passes would */
+typedef struct {
+    int lineno;
+    int order;          /* Where on its line the error was hit */
+    int in_operands;
+    int seq;
+    char *text;
+} error_rec;
+
+static error_rec *errors = NULL;
+static int nerrors = 0;
+static int errcap = 0;
+
+/* Hold back the error for the current line.  An error hit once n
+   fixups exist has order 2n, and fixup i that is never resolved has
+   order 2i+1, so on each line they sort in the order they were hit */
+static void record_error(char *message, int order)
+{
+    char text[2 * STRMAX];
+    error_rec *e;
+    if (nerrors >= errcap) {
+	errcap = errcap ? 2 * errcap : 64;
+	errors = (error_rec *) realloc(errors, errcap * sizeof(error_rec));
+    }
+    snprintf(text, sizeof(text),
+	     "Error on line %d: %s\nLine %d, Byte 0x%.4x: %s\n",
+	     lineno, message, lineno, bytepos, input_line);
+    e = &errors[nerrors];
+    e->lineno = lineno;
+    e->order = order;
+    e->in_operands = in_operands;
+    e->seq = nerrors++;
+    e->text = strdup(text);
+}
+
+static int error_cmp(const void *a, const void *b)
+{
+    const error_rec *x = (const error_rec *) a;
+    const error_rec *y = (const error_rec *) b;
+    if (x->lineno != y->lineno)
+	return x->lineno - y->lineno;
+    if (x->order != y->order)
+	return x->order - y->order;
+    return x->seq - y->seq;
+}
+
+/* Print the held back errors.  After an error that pass 1 would
+   catch, the second pass would not run, so its errors are dropped */
+static void print_errors()
+{
+    int i;
+    int last = 0;
+    qsort(errors, nerrors, sizeof(error_rec), error_cmp);
+    for (i = 0; i < nerrors; i++) {
+	if (pass1_error && errors[i].in_operands)
+	    continue;
+	if (errors[i].lineno == last)
+	    continue;
+	last = errors[i].lineno;
+	fputs(errors[i].text, stderr);
+    }
+    nerrors = 0;
+}
+
 void fail(char *message)
 {
     if (!error_mode) {
-	fprintf(stderr, "Error on line %d: %s\n", lineno, message);
-	fprintf(stderr, "Line %d, Byte 0x%.4x: %s\n",
-		lineno, bytepos, input_line);
+	if (one_pass)
+	    record_error(message, 2 * nfixups);
+	else {
+	    fprintf(stderr, "Error on line %d: %s\n", lineno, message);
+	    fprintf(stderr, "Line %d, Byte 0x%.4x: %s\n",
+		    lineno, bytepos, input_line);
+	}
     }
     error_mode = 1;
     hit_error = 1;
+    if (!in_operands)
+	pass1_error = 1;
 }
 
 /* Parse Register from set of tokens and put into high or low
@@ -231,7 +375,7 @@ void get_num(int codepos, int bytes, int offset)
     if (tokens[tpos].type == TOK_NUM) {
 	val = tokens[tpos].ival;
     } else if (tokens[tpos].type == TOK_IDENT) {
-	val = find_symbol(tokens[tpos].sval);
+	val = find_symbol(tokens[tpos].sym, codepos, bytes);
     } else {
 	fail("Number Expected");
 	return;
@@ -264,7 +408,7 @@ void get_mem(int codepos)
 	val = tokens[tpos++].ival;
 	type = tokens[tpos].type;
     } else if (type == TOK_IDENT) {
-	val = find_symbol(tokens[tpos++].sval);
+	val = find_symbol(tokens[tpos++].sym, codepos+1, 8);
 	type = tokens[tpos].type;    
     }
     /* Check for optional register */
@@ -298,6 +442,8 @@ void start_line()
     tcount = 0;
     bcount = 0;
     strpos = 0;
+    in_operands = 0;
+    line_fixups = nfixups;
     for (t = 0; t < TOK_PER_LINE; t++)
 	tokens[t].type = TOK_ERR;
 }
@@ -329,8 +475,8 @@ void finish_line()
 	    start_line();
 	    return;
 	} else {
-	    if (pass == 1)
-		add_symbol(tokens[0].sval, bytepos);
+	    if (pass == 1 || one_pass)
+		add_symbol(tokens[0].sym, bytepos);
 	    tpos+=2;
 	    if (tcount == 2) {
 		/* That's all for this line */
@@ -395,6 +541,7 @@ void finish_line()
     }
 
     /* Here's where we really process the instructions */
+    in_operands = 1;
     code[0] = instr->code;
     code[1] = HPACK(REG_NONE, REG_NONE);
     switch(instr->arg1) {
@@ -439,19 +586,24 @@ void finish_line()
     }
 
     print_code(outfile, savebytepos);
+    place_fixups();
     start_line();
 }
 
 void add_token(token_t type, char *s, word_t i, char c)
 {
     char *t = NULL;
+    sym_ptr sym = NULL;
     if (!tcount)
 	start_line();
     if (tpos >= TOK_PER_LINE-1) {
 	fail("Line too long");
 	return;
     }
-    if (s) {
+    if (type == TOK_IDENT) {
+	sym = intern(s);
+	t = sym->name;
+    } else if (s) {
 	int len = strlen(s)+1;
 	if (strpos + len > STRMAX) {
 	    fail("Line too long");
@@ -464,6 +616,7 @@ void add_token(token_t type, char *s, word_t i, char c)
     tokens[tcount].sval = t;
     tokens[tcount].ival = i;
     tokens[tcount].cval = c;
+    tokens[tcount].sym = sym;
     tcount++;
 }
 
@@ -492,33 +645,185 @@ void add_punct(char c)
     add_token(TOK_PUNCT, NULL, 0, c);
 }
 
-#define STAB 1000
+/* Names and symbols are carved out of large chunks, and never freed */
+#define ARENA_CHUNK 65536
 
-#define INIT_CNT 0
+static char *arena = NULL;
+static int arena_left = 0;
 
-int symbol_cnt = INIT_CNT;
-struct {
-    char *name;
-    int pos;
-} symbol_table[STAB];
+static void *arena_alloc(int n)
+{
+    void *p;
+    n = (n + 7) & ~7;
+    if (n > arena_left) {
+	int size = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+	arena = (char *) malloc(size);
+	if (!arena) {
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+	arena_left = size;
+    }
+    p = arena;
+    arena += n;
+    arena_left -= n;
+    return p;
+}
+
+/* Hash table of interned symbols.  Doubles in size when it has as many
+   symbols as buckets */
+static sym_ptr *buckets = NULL;
+static int nbuckets = 0;
+static int nsyms = 0;
+
+/* Defined symbols, in order of definition */
+static sym_ptr *defs = NULL;
+static int ndefs = 0;
+static int defcap = 0;
+
+static unsigned hash_name(char *name)
+{
+    /* FNV-1a */
+    unsigned h = 2166136261u;
+    for (; *name; name++)
+	h = (h ^ (unsigned char) *name) * 16777619u;
+    return h;
+}
+
+static void grow_buckets()
+{
+    int newsize = nbuckets ? 2 * nbuckets : 1024;
+    sym_ptr *newb = (sym_ptr *) calloc(newsize, sizeof(sym_ptr));
+    int b;
+    if (!newb) {
+	fprintf(stderr, "Out of memory\n");
+	exit(1);
+    }
+    for (b = 0; b < nbuckets; b++) {
+	sym_ptr sym = buckets[b];
+	while (sym) {
+	    sym_ptr next = sym->next;
+	    unsigned nb = hash_name(sym->name) & (newsize - 1);
+	    sym->next = newb[nb];
+	    newb[nb] = sym;
+	    sym = next;
+	}
+    }
+    free(buckets);
+    buckets = newb;
+    nbuckets = newsize;
+}
+
+/* Find the symbol for name, creating it if this is its first use */
+sym_ptr intern(char *name)
+{
+    unsigned h;
+    sym_ptr sym;
+
+    if (nsyms >= nbuckets)
+	grow_buckets();
+    h = hash_name(name) & (nbuckets - 1);
+    for (sym = buckets[h]; sym; sym = sym->next)
+	if (strcmp(name, sym->name) == 0)
+	    return sym;
+    sym = (sym_ptr) arena_alloc(sizeof(sym_rec));
+    sym->name = strcpy((char *) arena_alloc(strlen(name)+1), name);
+    sym->pos = 0;
+    sym->defined = 0;
+    sym->fixups = -1;
+    sym->next = buckets[h];
+    buckets[h] = sym;
+    nsyms++;
+    return sym;
+}
+
+/* Write the value of sym into the hex digits of fixup f */
+static void patch(fixup_rec *f, word_t val)
+{
+    int i;
+    for (i = 0; i < f->bytes; i++)
+	hexstuff(outbuf + f->bufpos + 2*i, (val >> (i * 8)) & 0xFF, 2);
+}
 
-void add_symbol(char *name, int p)
+/* The line just printed begins at line_start.  Locate the values of its
+   forward references */
+void place_fixups()
 {
-    char *t = (char *) malloc(strlen(name)+1);
-    strcpy(t, name);
-    symbol_table[symbol_cnt].name = t;
-    symbol_table[symbol_cnt].pos = p;
-    symbol_cnt++;
+    int i;
+    for (i = line_fixups; i < nfixups; i++)
+	fixups[i].bufpos = line_start + 7 + 2 * fixups[i].codepos;
+}
+
+void add_symbol(sym_ptr sym, int p)
+{
+    int f;
+    /* The first definition of a label is the one that counts */
+    if (sym->defined)
+	return;
+    sym->pos = p;
+    sym->defined = 1;
+    if (ndefs >= defcap) {
+	defcap = defcap ? 2 * defcap : 1024;
+	defs = (sym_ptr *) realloc(defs, defcap * sizeof(sym_ptr));
+    }
+    defs[ndefs++] = sym;
+    for (f = sym->fixups; f >= 0; f = fixups[f].next)
+	if (fixups[f].bufpos >= 0)
+	    patch(&fixups[f], p);
+    sym->fixups = -1;
+}
+
+/* Value of sym, used for the bytes-byte value at codepos in the current
+   instruction.  In one-pass mode, a label that is not yet defined gets
+   a fixup, and the value is filled in later */
+word_t find_symbol(sym_ptr sym, int codepos, int bytes)
+{
+    fixup_rec *f;
+    if (sym->defined)
+	return sym->pos;
+    if (!one_pass) {
+	fail("Can't find label");
+	return -1;
+    }
+    if (nfixups >= fixcap) {
+	fixcap = fixcap ? 2 * fixcap : 1024;
+	fixups = (fixup_rec *) realloc(fixups, fixcap * sizeof(fixup_rec));
+    }
+    f = &fixups[nfixups];
+    f->sym = sym;
+    f->next = sym->fixups;
+    f->codepos = codepos;
+    f->bytes = bytes;
+    f->bufpos = -1;
+    f->lineno = lineno;
+    f->bytepos = bytepos;
+    sym->fixups = nfixups++;
+    return 0;
 }
 
-int find_symbol(char *name)
+/* Report the references that were never resolved and give them the
+   value -1, as the second pass would */
+static void check_fixups()
 {
     int i;
-    for (i = 0; i < symbol_cnt; i++)
-	if (strcmp(name, symbol_table[i].name) == 0)
-	    return symbol_table[i].pos;
-    fail("Can't find label");
-    return -1;
+    in_operands = 1;
+    for (i = 0; i < nfixups; i++) {
+	fixup_rec *f = &fixups[i];
+	char *text;
+	int len;
+	if (f->sym->defined || f->bufpos < 0)
+	    continue;
+	patch(f, -1);
+	/* Recover the source line from the listing */
+	text = strchr(outbuf + f->bufpos, '|') + 2;
+	len = strchr(text, '\n') - text;
+	memcpy(input_line, text, len);
+	input_line[len] = '\0';
+	lineno = f->lineno;
+	bytepos = f->bytepos;
+	record_error("Can't find label", 2 * i + 1);
+	hit_error = 1;
+    }
 }
 
 int yywrap()
@@ -529,8 +834,8 @@ int yywrap()
     }
     if (verbose && pass > 1) {
 	printf("Symbol Table:\n");
-	for (i = INIT_CNT; i < symbol_cnt; i++)
-	    printf(" %s\t0x%x\n", symbol_table[i].name, symbol_table[i].pos);
+	for (i = 0; i < ndefs; i++)
+	    printf(" %s\t0x%x\n", defs[i]->name, defs[i]->pos);
     }
     return 1;
 }
@@ -540,7 +845,8 @@ int yylex();
 
 static void usage(char *pname)
 {
-    printf("Usage: %s [-V[n]] file.ys\n", pname);
+    printf("Usage: %s [-2] [-V[n]] file.ys\n", pname);
+    printf("   -2     Make two passes over the input, rather than one\n");
     printf("   -V[n]  Generate memory initialization in Verilog format (n-way blocking)\n");
     exit(0);
 }
@@ -553,7 +859,7 @@ int main(int argc, char *argv[])
     int nextarg = 1;
     if (argc < 2)
 	usage(argv[0]);
-    if (argv[nextarg][0] == '-') {
+    while (nextarg < argc && argv[nextarg][0] == '-') {
       char flag = argv[nextarg][1];
       switch (flag) {
       case 'V':
@@ -565,12 +871,20 @@ int main(int argc, char *argv[])
 		exit(1);
 	    }
 	}
-	nextarg++;
+	break;
+      case '2':
+	one_pass = 0;
 	break;
       default:
 	usage(argv[0]);
       }
+      nextarg++;
     }
+    if (nextarg >= argc)
+	usage(argv[0]);
+    /* Verilog output is not buffered, so it needs the second pass */
+    if (vcode)
+	one_pass = 0;
     rootlen = strlen(argv[nextarg])-3;
     if (strcmp(argv[nextarg]+rootlen, ".ys"))
 	usage(argv[0]);
@@ -599,6 +913,18 @@ int main(int argc, char *argv[])
       }
     }
 
+    if (one_pass) {
+	pass = 2;
+	yylex();
+	fclose(yyin);
+	check_fixups();
+	print_errors();
+	if (!pass1_error)
+	    fwrite(outbuf, 1, outlen, outfile);
+	fclose(outfile);
+	return hit_error;
+    }
+
     pass = 1;
 
     yylex();
@@ -10,4 +10,4 @@ unsigned long long atollh(const char *);
 
 
 /* Current line number */
-int lineno;
+extern int lineno;
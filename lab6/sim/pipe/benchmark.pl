@@ -16,6 +16,7 @@ $pipe = "./psim";
 $gendriver = "./gen-driver.pl";
 $fname = "bdriver";
 $verbose = 1;
+$pipeopts = "";
 
 ## Grading criteria
 $totalpoints = 60;
@@ -30,15 +31,17 @@ $threshcpe = 10.5;
 # usage - Print the help message and terminate
 #
 sub usage {
-    print STDERR "Usage: $0 [-hq] [-n N] -f FILE\n";
+    print STDERR "Usage: $0 [-hq] [-n N] [-s SIM] [-o OPTS] -f FILE\n";
     print STDERR "   -h      Print help message\n";
     print STDERR "   -q      Quiet mode (default verbose)\n";
     print STDERR "   -n N    Set max number of elements up to 64 (default $blocklen)\n";
+    print STDERR "   -s SIM  Time with simulator SIM (default $pipe; e.g., ./wsim)\n";
+    print STDERR "   -o OPTS Pass options OPTS to the simulator (e.g., '-I 256:2:32')\n";
     print STDERR "   -f FILE Input .ys file is FILE\n";
     die "\n";
 }
 
-getopts('hqn:f:');
+getopts('hqn:s:o:f:');
 
 if ($opt_h) {
     usage();
@@ -48,6 +51,14 @@ if ($opt_q) {
     $verbose = 0;
 }
 
+if ($opt_s) {
+    $pipe = $opt_s;
+}
+
+if ($opt_o) {
+    $pipeopts = $opt_o;
+}
+
 if ($opt_n) {
     $blocklen = $opt_n;
     if ($blocklen < 0 || $blocklen > 64) {
@@ -75,13 +86,13 @@ for ($i = 0; $i <= $blocklen; $i++) {
 	die "Couldn't generate driver file $fname$i.ys\n";
     !(system "$yas $fname$i.ys") ||
 	die "Couldn't assemble file $fname$i.ys\n";
-    $stat = `$pipe -v 0 $fname$i.yo` ||
+    $stat = `$pipe $pipeopts -v 0 $fname$i.yo` ||
 	die "Couldn't simulate file $fname$i.yo\n";
     !(system "rm $fname$i.ys $fname$i.yo") ||
 	die "Couldn't remove files $fname$i.ys and/or $fname$i.yo\n";
-    chomp $stat;
-    $stat =~ s/[ ]*CPI:[ ]*//;
-    $stat =~ s/ cycles.*//;
+    # Keep just the cycle count from the CPI line.  Other reports that
+    # the options ask for follow it
+    $stat =~ s/.*CPI:[ ]*([0-9]+) cycles.*/$1/s;
     if ($i > 0) {
       $cpe = $stat/$i;
       if ($verbose) {
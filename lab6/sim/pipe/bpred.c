@@ -0,0 +1,229 @@
+/*
+ * bpred.c - Branch prediction models for the PIPE simulator
+ *
+ * Conditional jumps are predicted by one of:
+ *   taken	Always taken (what pipe-std does)
+ *   nt		Never taken
+ *   btfnt	Backward taken, forward not taken
+ *   2bit[:n]	Table of 2^n two-bit saturating counters indexed by PC
+ *   gshare[:n]	Table of 2^n two-bit counters indexed by PC xor the
+ *		outcomes of the last n conditional jumps
+ * Returns are predicted by a return address stack, if one is
+ * configured, and otherwise mispredicted as falling through.
+ *
+ * Counters and history are trained when a jump leaves the memory stage,
+ * by which time it is known to be on the correct path.  The stack is
+ * pushed and popped when calls and rets enter decode, and the change is
+ * undone if the instruction is squashed.  A squashed call can still
+ * have overwritten the oldest entry of a full stack.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "bpred.h"
+
+#define DEFAULT_BITS 10
+#define MAX_BITS 20
+
+/* Size of a jump instruction, giving its fall-through address */
+#define JUMP_LEN 9
+
+typedef enum { BP_TAKEN, BP_NT, BP_BTFNT, BP_2BIT, BP_GSHARE } bp_model_t;
+
+static char *model_names[] = { "taken", "nt", "btfnt", "2bit", "gshare" };
+
+static bp_model_t model = BP_TAKEN;
+static int bits = DEFAULT_BITS;
+
+/* Two-bit counters.  Values 2 and 3 predict taken */
+static byte_t *counters = NULL;
+static word_t history = 0;
+
+/* Return address stack, kept as a circular buffer that overwrites its
+   oldest entry when full */
+static word_t *ras = NULL;
+static int ras_depth = 0;
+static int ras_top = 0;
+static int ras_cnt = 0;
+
+/* Statistics */
+static word_t cjumps, cjump_misses;
+static word_t rets, ret_misses;
+
+bool_t bp_active = FALSE;
+
+/* Each spec starts from the default size, so nothing carries over from
+   an earlier one.  A spec that is not valid changes nothing */
+bool_t bp_set_model(char *spec)
+{
+    int m;
+    int b = DEFAULT_BITS;
+    char *colon = strchr(spec, ':');
+    size_t len = colon ? (size_t) (colon - spec) : strlen(spec);
+
+    for (m = BP_TAKEN; m <= BP_GSHARE; m++)
+	if (strlen(model_names[m]) == len &&
+	    strncmp(spec, model_names[m], len) == 0)
+	    break;
+    if (m > BP_GSHARE)
+	return FALSE;
+    if (colon) {
+	if (m != BP_2BIT && m != BP_GSHARE)
+	    return FALSE;
+	b = atoi(colon+1);
+	if (b < 1 || b > MAX_BITS)
+	    return FALSE;
+    }
+    model = m;
+    bits = b;
+    bp_reset();
+    return TRUE;
+}
+
+void bp_set_ras(int depth)
+{
+    free(ras);
+    ras = NULL;
+    ras_depth = depth > 0 ? depth : 0;
+    if (ras_depth)
+	ras = (word_t *) calloc(ras_depth, sizeof(word_t));
+    bp_reset();
+}
+
+void bp_reset()
+{
+    int n = 1 << bits;
+
+    if (model == BP_2BIT || model == BP_GSHARE) {
+	if (!counters)
+	    counters = (byte_t *) malloc(1 << MAX_BITS);
+	/* Start out weakly taken */
+	memset(counters, 2, n);
+    }
+    history = 0;
+    ras_top = ras_cnt = 0;
+    cjumps = cjump_misses = rets = ret_misses = 0;
+    bp_active = FALSE;
+}
+
+static inline word_t counter_index(word_t pc)
+{
+    word_t mask = ((word_t) 1 << bits) - 1;
+    if (model == BP_GSHARE)
+	return (pc ^ history) & mask;
+    return pc & mask;
+}
+
+/* Predict the direction of the conditional jump at pc */
+static bool_t predict_taken(word_t pc, word_t valc)
+{
+    switch (model) {
+    case BP_TAKEN:
+	return TRUE;
+    case BP_NT:
+	return FALSE;
+    case BP_BTFNT:
+	return valc <= pc;
+    case BP_2BIT:
+    case BP_GSHARE:
+    default:
+	return counters[counter_index(pc)] >= 2;
+    }
+}
+
+word_t bp_predict(word_t pc, word_t icode, word_t ifun,
+		  word_t valc, word_t valp)
+{
+    bp_active = TRUE;
+    switch (icode) {
+    case I_JMP:
+	if (ifun == C_YES || predict_taken(pc, valc))
+	    return valc;
+	return valp;
+    case I_CALL:
+	return valc;
+    case I_RET:
+	if (ras_cnt > 0)
+	    return ras[ras_top];
+	return valp;
+    default:
+	return valp;
+    }
+}
+
+void bp_fetched(byte_t icode, word_t valp)
+{
+    if (!ras_depth)
+	return;
+    if (icode == I_CALL) {
+	ras_top = (ras_top + 1) % ras_depth;
+	ras[ras_top] = valp;
+	if (ras_cnt < ras_depth)
+	    ras_cnt++;
+    } else if (icode == I_RET && ras_cnt > 0) {
+	ras_top = (ras_top + ras_depth - 1) % ras_depth;
+	ras_cnt--;
+    }
+}
+
+void bp_squashed(byte_t icode)
+{
+    if (!ras_depth)
+	return;
+    if (icode == I_CALL && ras_cnt > 0) {
+	ras_top = (ras_top + ras_depth - 1) % ras_depth;
+	ras_cnt--;
+    } else if (icode == I_RET && ras_cnt < ras_depth) {
+	/* The popped entry is still there unless a younger call, itself
+	   squashed by now, overwrote it */
+	ras_top = (ras_top + 1) % ras_depth;
+	ras_cnt++;
+    }
+}
+
+void bp_resolve_jump(word_t pc, byte_t ifun, bool_t taken, word_t predpc)
+{
+    bool_t predicted = predpc != pc + JUMP_LEN;
+
+    if (ifun == C_YES)
+	return;
+    cjumps++;
+    if (predicted != taken)
+	cjump_misses++;
+    if (model == BP_2BIT || model == BP_GSHARE) {
+	byte_t *c = &counters[counter_index(pc)];
+	if (taken && *c < 3)
+	    (*c)++;
+	else if (!taken && *c > 0)
+	    (*c)--;
+	history = ((history << 1) | (taken ? 1 : 0)) & (((word_t) 1 << bits) - 1);
+    }
+}
+
+void bp_resolve_ret(word_t predpc, word_t target)
+{
+    rets++;
+    if (predpc != target)
+	ret_misses++;
+}
+
+static void report_line(FILE *out, char *what, word_t n, word_t misses)
+{
+    fprintf(out, "  %-18s%8lld executed, %8lld mispredicted", what, n, misses);
+    if (n > 0)
+	fprintf(out, " (%.2f%% correct)", 100.0 * (n - misses) / n);
+    fprintf(out, "\n");
+}
+
+void bp_report(FILE *out)
+{
+    fprintf(out, "Branch prediction: %s", model_names[model]);
+    if (model == BP_2BIT || model == BP_GSHARE)
+	fprintf(out, ":%d", bits);
+    fprintf(out, ", return address stack of %d\n", ras_depth);
+    report_line(out, "Conditional jumps", cjumps, cjump_misses);
+    report_line(out, "Returns", rets, ret_misses);
+}
@@ -0,0 +1,41 @@
+/*
+ * bpred.h - Branch prediction models for the PIPE simulator
+ *
+ * The HCL for a processor that uses these (pipe-bp.hcl) asks for the
+ * predicted address of the instruction following the one being fetched
+ * with bp_predict.  The simulator tells the predictor when a call or ret
+ * is accepted into decode or squashed after that, and when a jump or ret
+ * leaves the memory stage, where its real successor is known.
+ */
+
+/* Select a prediction model from a string of the form NAME[:BITS].
+   Returns FALSE if the string is not recognized */
+bool_t bp_set_model(char *spec);
+
+/* Set the number of entries in the return address stack (0 = none) */
+void bp_set_ras(int depth);
+
+/* Clear predictor tables and statistics */
+void bp_reset();
+
+/* Has the HCL made any predictions since the last reset? */
+extern bool_t bp_active;
+
+/* Predicted address of the instruction following the one at pc */
+word_t bp_predict(word_t pc, word_t icode, word_t ifun,
+		  word_t valc, word_t valp);
+
+/* An instruction has been accepted into the decode stage */
+void bp_fetched(byte_t icode, word_t valp);
+
+/* An instruction in decode or execute has been squashed */
+void bp_squashed(byte_t icode);
+
+/* A conditional or unconditional jump at pc has been resolved */
+void bp_resolve_jump(word_t pc, byte_t ifun, bool_t taken, word_t predpc);
+
+/* A ret predicted to return to predpc has returned to target */
+void bp_resolve_ret(word_t predpc, word_t target);
+
+/* Print prediction accuracy */
+void bp_report(FILE *out);
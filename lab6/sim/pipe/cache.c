@@ -0,0 +1,149 @@
+/*
+ * cache.c - Cache timing model for the PIPE simulator
+ *
+ * A set-associative cache of tags with LRU or random replacement.  The
+ * simulator asks it how many blocks an access moves to or from memory,
+ * and turns that into stall cycles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "isa.h"
+#include "cache.h"
+
+typedef enum { R_LRU, R_RANDOM } repl_t;
+
+static char *repl_names[] = { "LRU", "random" };
+
+typedef struct {
+    bool_t valid;
+    bool_t dirty;
+    word_t tag;
+    word_t stamp;       /* Time of last use, for LRU */
+} line_t;
+
+struct cache_rec {
+    int size, assoc, block;
+    repl_t repl;
+    int nsets;
+    int block_bits;
+    line_t *lines;      /* nsets sets of assoc lines */
+    word_t now;         /* Number of accesses, for LRU */
+    unsigned seed;      /* State of the random victim chooser */
+    /* Statistics */
+    word_t accesses, misses, writebacks;
+};
+
+static bool_t is_pow2(int x)
+{
+    return x > 0 && (x & (x - 1)) == 0;
+}
+
+cache_t cache_new(char *spec)
+{
+    int size, assoc, block;
+    char policy[16] = "lru";
+    int n = sscanf(spec, "%d:%d:%d:%15s", &size, &assoc, &block, policy);
+    cache_t c;
+
+    if (n < 3 || !is_pow2(block) || assoc < 1 ||
+	size % (assoc * block) != 0 || !is_pow2(size / (assoc * block)))
+	return NULL;
+    c = (cache_t) calloc(1, sizeof(struct cache_rec));
+    if (strcmp(policy, "lru") == 0)
+	c->repl = R_LRU;
+    else if (strcmp(policy, "random") == 0)
+	c->repl = R_RANDOM;
+    else {
+	free(c);
+	return NULL;
+    }
+    c->size = size;
+    c->assoc = assoc;
+    c->block = block;
+    c->nsets = size / (assoc * block);
+    for (c->block_bits = 0; (1 << c->block_bits) < block; c->block_bits++)
+	;
+    c->lines = (line_t *) malloc(c->nsets * assoc * sizeof(line_t));
+    cache_reset(c);
+    return c;
+}
+
+void cache_reset(cache_t c)
+{
+    memset(c->lines, 0, c->nsets * c->assoc * sizeof(line_t));
+    c->now = 0;
+    c->seed = 1;
+    c->accesses = c->misses = c->writebacks = 0;
+}
+
+/* Look up the block with number blk.  Returns the number of blocks moved */
+static int access_block(cache_t c, word_t blk, bool_t write)
+{
+    line_t *set = &c->lines[(blk & (c->nsets - 1)) * c->assoc];
+    word_t tag = blk;   /* Keeping the set bits in the tag does no harm */
+    line_t *victim = NULL;
+    int moved = 0;
+    int i;
+
+    c->accesses++;
+    c->now++;
+    for (i = 0; i < c->assoc; i++) {
+	line_t *l = &set[i];
+	if (l->valid && l->tag == tag) {
+	    l->stamp = c->now;
+	    l->dirty |= write;
+	    return 0;
+	}
+	if (!l->valid && !victim)
+	    victim = l;
+    }
+
+    /* Miss.  Fill an invalid line if there is one, else evict */
+    c->misses++;
+    if (!victim) {
+	if (c->repl == R_RANDOM) {
+	    c->seed = c->seed * 1103515245 + 12345;
+	    victim = &set[(c->seed >> 16) % c->assoc];
+	} else {
+	    victim = &set[0];
+	    for (i = 1; i < c->assoc; i++)
+		if (set[i].stamp < victim->stamp)
+		    victim = &set[i];
+	}
+	if (victim->dirty) {
+	    c->writebacks++;
+	    moved++;
+	}
+    }
+    victim->valid = TRUE;
+    victim->dirty = write;
+    victim->tag = tag;
+    victim->stamp = c->now;
+    return moved + 1;
+}
+
+int cache_access(cache_t c, word_t addr, int len, bool_t write)
+{
+    word_t first = (uword_t) addr >> c->block_bits;
+    word_t last = (uword_t) (addr + len - 1) >> c->block_bits;
+    word_t blk;
+    int moved = 0;
+
+    for (blk = first; blk <= last; blk++)
+	moved += access_block(c, blk, write);
+    return moved;
+}
+
+void cache_report(FILE *out, char *name, cache_t c)
+{
+    fprintf(out, "%s: %d bytes, %d-way, %d-byte blocks, %s\n", name,
+	    c->size, c->assoc, c->block, repl_names[c->repl]);
+    fprintf(out, "  %8lld accesses, %8lld misses", c->accesses, c->misses);
+    if (c->accesses > 0)
+	fprintf(out, " (%.2f%% hits)",
+		100.0 * (c->accesses - c->misses) / c->accesses);
+    fprintf(out, ", %lld writebacks\n", c->writebacks);
+}
@@ -0,0 +1,25 @@
+/*
+ * cache.h - Cache timing model for the PIPE simulator
+ *
+ * A cache only keeps tags, so it decides how long an access takes but
+ * never what it returns: the simulator still reads and writes its single
+ * memory array.  Caches are write-back and write-allocate.
+ */
+
+typedef struct cache_rec *cache_t;
+
+/* Create a cache from a string of the form SIZE:ASSOC:BLOCK[:POLICY],
+   where sizes are in bytes and POLICY is lru (default) or random.
+   Returns NULL if the string is not valid */
+cache_t cache_new(char *spec);
+
+/* Invalidate all lines and clear statistics */
+void cache_reset(cache_t c);
+
+/* Access len bytes starting at addr.  Returns the number of blocks that
+   had to be moved to or from memory: one per missing block, plus one for
+   each dirty block written back to make room */
+int cache_access(cache_t c, word_t addr, int len, bool_t write);
+
+/* Print the configuration and hit rate of cache c, labelled name */
+void cache_report(FILE *out, char *name, cache_t c);
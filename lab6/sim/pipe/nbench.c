@@ -0,0 +1,687 @@
+/**************************************************************************
+ * nbench.c - Benchmark and correctness driver for ncopy
+ *
+ * Does the work of benchmark.pl and correctness.pl without running
+ * gen-driver.pl, yas, psim and yis once per array length.  A timing
+ * driver and a checking driver, as gen-driver.pl writes them, are
+ * generated and assembled once.  Each run then patches the element
+ * count, the source data, the checker's expected values and the places
+ * of the blocks and the stack for its length into a private copy of
+ * that memory image, so every address is the one gen-driver.pl would
+ * give it, and runs the pipeline simulator on it directly.
+ *
+ * The simulator keeps its state in globals, so the runs are spread over
+ * forked worker processes rather than threads.  Each worker sends back
+ * a fixed-size record per run through a pipe.
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "isa.h"
+#include "pipeline.h"
+#include "stages.h"
+#include "sim.h"
+#include "bpred.h"
+#include "cache.h"
+
+#define MAXBUF 1024
+
+/* Limits shared with benchmark.pl and correctness.pl */
+#define MAXBLOCK 64     /* Largest -n accepted by benchmark.pl */
+#define OVER 3          /* Number of longer lengths tried by correctness.pl */
+
+/* Grading criteria, as in benchmark.pl */
+#define TOTALPOINTS 60.0
+#define FULLCPE 7.5     /* CPE required to get full credit */
+#define THRESHCPE 10.5  /* CPE required to get nonzero credit */
+
+/* Values placed around the source and destination blocks */
+#define PREVAL  0xbcdefa
+#define POSTVAL 0xdefabc
+#define DESTVAL 0xcdefab
+
+/* Results left in %rax by the checking code */
+#define CHECK_OK    0xaaaa
+#define CHECK_COUNT 0xbbbb
+#define CHECK_LEN   0xcccc
+#define CHECK_COPY  0xdddd
+#define CHECK_CORRUPT 0xeeee
+
+/* Parameters modified by the command line */
+static int blocklen = MAXBLOCK;     /* Largest benchmark length (-n) */
+static int bytelim = 1000;          /* Byte limit for ncopy (-b) */
+static int verbose = 1;             /* Print per-length results (-q) */
+static bool_t csv = FALSE;          /* Print timing runs as CSV only (-c) */
+static int njobs = 0;               /* Worker processes (-j), 0 = #cpus */
+static unsigned seed = 1;           /* Seed for the array contents (-s) */
+static char *yas = "../misc/yas";   /* Assembler (-a) */
+static char *ncopy_name = "ncopy.ys";
+
+/* Instruction limit per run, shared with psim's -l */
+extern word_t instr_limit;
+
+/* Caches and miss penalty, shared with psim's -I, -D and -P */
+extern cache_t icache, dcache;
+extern int miss_penalty;
+
+/*
+ * Places in the drivers that get patched for each run.  The label
+ * names are chosen so as not to collide with those in ncopy.ys.  The
+ * labels from L_RVAL on are only in the checking driver.
+ */
+typedef enum { L_STACK, L_COUNT, L_DEST, L_SRC,
+	       L_RVAL, L_CDEST, L_CCOUNT, L_PRE, L_POST, NLABEL } label_t;
+
+static char *label_names[NLABEL] = {
+    "main", "NbCount", "NbDest", "src",
+    "NbRval", "NbCdest", "NbCcount", "NbPre", "NbPost"
+};
+
+/* An assembled driver */
+typedef struct {
+    mem_t image;
+    word_t addr[NLABEL];
+} driver_t;
+
+static driver_t drivers[2];     /* Timing and checking drivers */
+
+/* One run of the simulator */
+typedef struct {
+    int len;            /* Number of elements */
+    bool_t check;       /* Run checking code rather than just timing */
+} job_t;
+
+typedef struct {
+    int job;            /* Index into the job table */
+    word_t cycles;      /* Pipeline cycles (as in psim's CPI line) */
+    word_t instrs;      /* Instructions completed */
+    word_t rax;         /* %rax from the pipeline */
+    word_t isa_rax;     /* %rax from the ISA simulator */
+    byte_t status;      /* Pipeline status at the end of the run */
+} result_t;
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-hqc] [-n N] [-b blim] [-j jobs] [-s seed] [-l m] [-a yas]\n", name);
+    printf("       [-B model] [-R n] [-I cache] [-D cache] [-P n] [-f FILE]\n");
+    printf("   -h      Print this message\n");
+    printf("   -q      Quiet mode (default verbose)\n");
+    printf("   -c      Only time, printing len,cycles,instrs,CPI,CPE,status lines\n");
+    printf("   -n N    Set max number of elements up to %d (default %d)\n",
+	   MAXBLOCK, blocklen);
+    printf("   -b blim Set byte limit for function (default %d)\n", bytelim);
+    printf("   -j jobs Number of worker processes (default one per CPU)\n");
+    printf("   -s seed Seed for the array contents (default %u)\n", seed);
+    printf("   -l m    Set instruction limit per run to m (default %lld)\n",
+	   instr_limit);
+    printf("   -a yas  Assembler to use (default %s)\n", yas);
+    printf("   -B m    Branch predictor, as psim -b (VERSION=bp only)\n");
+    printf("   -R n    Return address stack entries, as psim -R (VERSION=bp only)\n");
+    printf("   -I c    Instruction cache, as psim -I\n");
+    printf("   -D c    Data cache, as psim -D\n");
+    printf("   -P n    Cache miss penalty, as psim -P (default %d)\n",
+	   miss_penalty);
+    printf("   -f FILE Input .ys file is FILE (default %s)\n", ncopy_name);
+    exit(0);
+}
+
+/*
+ * write_driver - Emit the driver of gen-driver.pl (with -c if check is
+ * set) for maxlen elements, with labels on the instructions that
+ * depend on the length.
+ */
+static void write_driver(FILE *out, FILE *code, int maxlen, bool_t check)
+{
+    char buf[MAXBUF];
+    int i;
+
+    fprintf(out,
+	    "\t.pos 0\n"
+	    "main:\tirmovq Stack, %%rsp\n"
+	    "NbCount:\tirmovq $%d, %%rdx\n"
+	    "NbDest:\tirmovq dest, %%rsi\n"
+	    "\tirmovq src, %%rdi\n"
+	    "\tcall ncopy\n", maxlen);
+    if (check)
+	fprintf(out, "\tcall check\n");
+    fprintf(out,
+	    "\thalt\n"
+	    "StartFun:\n");
+    while (fgets(buf, MAXBUF, code))
+	fputs(buf, out);
+    fprintf(out, "\nEndFun:\n");
+    if (check)
+	fprintf(out,
+	    "check:\n"
+	    "NbRval:\tirmovq $0,%%r10\n"
+	    "\tsubq %%r10,%%rax\n"
+	    "\tje checkb\n"
+	    "\tirmovq $0x%x,%%rax\n"
+	    "\tjmp cdone\n"
+	    "checkb:\n"
+	    "\tirmovq EndFun,%%rax\n"
+	    "\tirmovq StartFun,%%rdx\n"
+	    "\tsubq %%rdx,%%rax\n"
+	    "\tirmovq $%d,%%rdx\n"
+	    "\tsubq %%rax,%%rdx\n"
+	    "\tjge checkm\n"
+	    "\tirmovq $0x%x,%%rax\n"
+	    "\tjmp cdone\n"
+	    "checkm:\n"
+	    "NbCdest:\tirmovq dest, %%rdx\n"
+	    "\tirmovq src,%%rbx\n"
+	    "NbCcount:\tirmovq $%d,%%rdi\n"
+	    "\tandq %%rdi,%%rdi\n"
+	    "\tje checkpre\n"
+	    "mcloop:\n"
+	    "\tmrmovq (%%rdx),%%rax\n"
+	    "\tmrmovq (%%rbx),%%rsi\n"
+	    "\tsubq %%rsi,%%rax\n"
+	    "\tje mok\n"
+	    "\tirmovq $0x%x,%%rax\n"
+	    "\tjmp cdone\n"
+	    "mok:\n"
+	    "\tirmovq $8,%%rax\n"
+	    "\taddq %%rax,%%rdx\n"
+	    "\taddq %%rax,%%rbx\n"
+	    "\tirmovq $1,%%rax\n"
+	    "\tsubq %%rax,%%rdi\n"
+	    "\tjg mcloop\n"
+	    "checkpre:\n"
+	    "NbPre:\tirmovq Predest,%%rdx\n"
+	    "\tmrmovq (%%rdx), %%rax\n"
+	    "\tirmovq $0x%x, %%rdx\n"
+	    "\tsubq %%rdx,%%rax\n"
+	    "\tje checkpost\n"
+	    "\tirmovq $0x%x,%%rax\n"
+	    "\tjmp cdone\n"
+	    "checkpost:\n"
+	    "NbPost:\tirmovq Postdest,%%rdx\n"
+	    "\tmrmovq (%%rdx), %%rax\n"
+	    "\tirmovq $0x%x, %%rdx\n"
+	    "\tsubq %%rdx,%%rax\n"
+	    "\tje checkok\n"
+	    "\tirmovq $0x%x,%%rax\n"
+	    "\tjmp cdone\n"
+	    "checkok:\n"
+	    "\tirmovq $0x%x,%%rax\n"
+	    "cdone:\n"
+	    "\tret\n",
+	    CHECK_COUNT, bytelim, CHECK_LEN, maxlen, CHECK_COPY,
+	    PREVAL, CHECK_CORRUPT, POSTVAL, CHECK_CORRUPT, CHECK_OK);
+
+    fprintf(out, "\t.align 8\nsrc:\n");
+    for (i = 0; i < maxlen; i++)
+	fprintf(out, "\t.quad 0\n");
+    fprintf(out, "\t.quad 0x%x\n\t.align 16\nPredest:\n\t.quad 0x%x\ndest:\n",
+	    PREVAL, PREVAL);
+    for (i = 0; i < maxlen; i++)
+	fprintf(out, "\t.quad 0x%x\n", DESTVAL);
+    fprintf(out, "Postdest:\n\t.quad 0x%x\n\t.align 8\n", POSTVAL);
+    for (i = 0; i < 16; i++)
+	fprintf(out, "\t.quad 0\n");
+    fprintf(out, "Stack:\n");
+}
+
+/*
+ * find_labels - Pick the addresses of the first nlabel patched labels
+ * out of the listing in a .yo file.
+ */
+static void find_labels(FILE *yo, driver_t *d, int nlabel)
+{
+    char buf[MAXBUF];
+    int i;
+
+    for (i = 0; i < NLABEL; i++)
+	d->addr[i] = -1;
+    while (fgets(buf, MAXBUF, yo)) {
+	char *bar = strchr(buf, '|');
+	char *name;
+	size_t len;
+	word_t addr;
+
+	if (!bar || sscanf(buf, " 0x%llx:", (unsigned long long *) &addr) != 1)
+	    continue;
+	name = bar + 1;
+	name += strspn(name, " \t");
+	len = strspn(name, "abcdefghijklmnopqrstuvwxyz"
+		     "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_");
+	if (len == 0 || name[len] != ':')
+	    continue;
+	for (i = 0; i < nlabel; i++)
+	    if (strlen(label_names[i]) == len &&
+		strncmp(name, label_names[i], len) == 0)
+		d->addr[i] = addr;
+    }
+    for (i = 0; i < nlabel; i++)
+	if (d->addr[i] < 0) {
+	    fprintf(stderr, "Couldn't find label %s in driver\n",
+		    label_names[i]);
+	    exit(1);
+	}
+}
+
+/*
+ * run_yas - Assemble ysname into the .yo file next to it.  Returns
+ * TRUE if that worked.
+ */
+static bool_t run_yas(char *ysname)
+{
+    pid_t pid;
+    int status;
+
+    if ((pid = fork()) < 0) {
+	perror("fork error");
+	return FALSE;
+    }
+    if (pid == 0) {
+	execlp(yas, yas, ysname, (char *) NULL);
+	fprintf(stderr, "Couldn't run %s\n", yas);
+	_exit(127);
+    }
+    while (waitpid(pid, &status, 0) < 0)
+	if (errno != EINTR)
+	    return FALSE;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/*
+ * assemble - Generate the driver for maxlen elements (the checking one
+ * if check is set), assemble it, and load the result into d.  The
+ * files go in $TMPDIR and are removed whether or not this works.
+ */
+static void assemble(driver_t *d, int maxlen, bool_t check)
+{
+    char ysname[MAXBUF], yoname[MAXBUF];
+    char *tmpdir = getenv("TMPDIR");
+    FILE *code, *out, *yo = NULL;
+    bool_t ok;
+    int fd;
+
+    if ((code = fopen(ncopy_name, "r")) == NULL) {
+	fprintf(stderr, "Can't open code file %s\n", ncopy_name);
+	exit(1);
+    }
+    if (!tmpdir || !*tmpdir)
+	tmpdir = "/tmp";
+    /* yas wants a .ys file, and writes the .yo file beside it */
+    snprintf(ysname, MAXBUF, "%s/nbdriverXXXXXX.ys", tmpdir);
+    if ((fd = mkstemps(ysname, 3)) < 0 || (out = fdopen(fd, "w")) == NULL) {
+	fprintf(stderr, "Couldn't generate driver file %s\n", ysname);
+	exit(1);
+    }
+    strcpy(yoname, ysname);
+    strcpy(yoname + strlen(yoname) - 3, ".yo");
+    write_driver(out, code, maxlen, check);
+    fclose(code);
+    if (fclose(out) == 0 && run_yas(ysname))
+	yo = fopen(yoname, "r");
+    unlink(ysname);
+    unlink(yoname);
+    if (yo == NULL) {
+	fprintf(stderr, "Couldn't assemble driver for %s\n", ncopy_name);
+	exit(1);
+    }
+
+    d->image = init_mem(MEM_SIZE);
+    ok = load_mem(d->image, yo, 1) != 0;
+    if (ok) {
+	rewind(yo);
+	find_labels(yo, d, check ? NLABEL : L_RVAL);
+    }
+    fclose(yo);
+    if (!ok) {
+	fprintf(stderr, "No lines of code found in driver for %s\n",
+		ncopy_name);
+	exit(1);
+    }
+}
+
+/*
+ * setup_run - Load the driver into the simulator's memory and patch it
+ * for the given job.  The blocks and the stack go where gen-driver.pl
+ * would put them for this length.  The array contents are chosen as in
+ * gen-driver.pl: a benchmark run copies exactly len/2 positive values,
+ * while a check run uses random signs.
+ */
+static void setup_run(job_t *j, int jobno)
+{
+    driver_t *d = &drivers[j->check];
+    word_t src = d->addr[L_SRC];
+    word_t predest = (src + 8*j->len + 8 + 15) & ~15;
+    word_t dest = predest + 8;
+    word_t postdest = dest + 8*j->len;
+    word_t stack = postdest + 8 + 16*8;
+    word_t tval = j->len / 2;
+    word_t rval = 0;
+    int i;
+
+    sim_reset();
+    memcpy(mem->contents, d->image->contents, d->image->len);
+    mem->maxaddr = d->image->maxaddr;
+
+    srandom(seed + jobno);
+    for (i = 0; i < j->len; i++) {
+	word_t val = -(i+1);
+	int coin = random() & 1;
+	int flip;
+
+	if (j->check)
+	    flip = coin;
+	else
+	    flip = (rval < tval && coin) || tval - rval >= j->len - i;
+	if (flip) {
+	    val = -val;
+	    rval++;
+	}
+	set_word_val(mem, src + 8*i, val);
+	set_word_val(mem, dest + 8*i, DESTVAL);
+    }
+    set_word_val(mem, src + 8*j->len, PREVAL);
+    set_word_val(mem, predest, PREVAL);
+    set_word_val(mem, postdest, POSTVAL);
+
+    set_word_val(mem, d->addr[L_STACK] + 2, stack);
+    set_word_val(mem, d->addr[L_COUNT] + 2, j->len);
+    set_word_val(mem, d->addr[L_DEST] + 2, dest);
+    if (j->check) {
+	set_word_val(mem, d->addr[L_RVAL] + 2, rval);
+	set_word_val(mem, d->addr[L_CDEST] + 2, dest);
+	set_word_val(mem, d->addr[L_CCOUNT] + 2, j->len);
+	set_word_val(mem, d->addr[L_PRE] + 2, predest);
+	set_word_val(mem, d->addr[L_POST] + 2, postdest);
+    }
+}
+
+/*
+ * run_job - Simulate one job on the pipeline, and for check runs on the
+ * ISA simulator as well.
+ */
+static void run_job(job_t *j, int jobno, result_t *r)
+{
+    state_ptr isa_state = NULL;
+    byte_t run_status = STAT_AOK;
+
+    setup_run(j, jobno);
+    if (j->check) {
+	isa_state = new_state(0);
+	free_mem(isa_state->m);
+	isa_state->m = copy_mem(mem);
+    }
+
+    sim_run_pipe(instr_limit, 5*instr_limit, &run_status, NULL);
+    r->job = jobno;
+    r->cycles = cycles;
+    r->instrs = instructions;
+    r->rax = get_reg_val(reg, REG_RAX);
+    r->status = run_status;
+    r->isa_rax = r->rax;
+
+    if (isa_state) {
+	stat_t e = STAT_AOK;
+	word_t step;
+
+	for (step = 0; step < instr_limit && e == STAT_AOK; step++)
+	    e = step_state(isa_state, NULL);
+	r->isa_rax = get_reg_val(isa_state->r, REG_RAX);
+	free_state(isa_state);
+    }
+}
+
+/*
+ * run_jobs - Run all jobs, spread over the worker processes, and fill
+ * in results[] in job order.
+ */
+static void run_jobs(job_t *jobs, int n, result_t *results)
+{
+    int fd[2];
+    int w, i, got;
+    result_t r;
+
+    if (njobs <= 0)
+	njobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs <= 0)
+	njobs = 1;
+    if (njobs > n)
+	njobs = n;
+
+    if (pipe(fd) < 0) {
+	perror("pipe error");
+	exit(1);
+    }
+    for (w = 0; w < njobs; w++) {
+	pid_t pid = fork();
+	if (pid < 0) {
+	    perror("fork error");
+	    exit(1);
+	}
+	if (pid == 0) {
+	    close(fd[0]);
+	    for (i = w; i < n; i += njobs) {
+		run_job(&jobs[i], i, &r);
+		/* Records are well under PIPE_BUF, so writes don't interleave */
+		if (write(fd[1], &r, sizeof(r)) != sizeof(r))
+		    _exit(1);
+	    }
+	    _exit(0);
+	}
+    }
+    close(fd[1]);
+
+    for (got = 0; got < n && read(fd[0], &r, sizeof(r)) == sizeof(r); got++)
+	results[r.job] = r;
+    close(fd[0]);
+    while (wait(NULL) > 0)
+	;
+    if (got < n) {
+	fprintf(stderr, "Only %d of %d simulations completed\n", got, n);
+	exit(1);
+    }
+}
+
+/* check_result - Describe the outcome of a check run, as correctness.pl */
+static char *check_result(result_t *r)
+{
+    if (r->rax != r->isa_rax)
+	return "Pipeline and ISA simulators disagree";
+    switch (r->rax) {
+    case CHECK_OK:
+	return "OK";
+    case CHECK_COUNT:
+	return "Bad count";
+    case CHECK_LEN:
+	return "Program too long";
+    case CHECK_COPY:
+	return "Incorrect copying";
+    case CHECK_CORRUPT:
+	return "Corruption before or after destination";
+    default:
+	return "failed";
+    }
+}
+
+/*
+ * print_csv - Print the timing runs for lengths 0..blocklen, one per
+ * line, ending with the final status (HLT if all went well).  CPE is
+ * left empty for length 0
+ */
+static void print_csv(result_t *results)
+{
+    int i;
+
+    for (i = 0; i <= blocklen; i++) {
+	result_t *r = &results[i];
+	printf("%d,%lld,%lld,%.3f,", i, r->cycles, r->instrs,
+	       r->instrs > 0 ? (double) r->cycles / r->instrs : 0.0);
+	if (i > 0)
+	    printf("%.3f", (double) r->cycles / i);
+	printf(",%s\n", stat_name(r->status));
+    }
+}
+
+/*
+ * sim_main - Called from the main() routine in the HCL file
+ */
+int sim_main(int argc, char **argv)
+{
+    int c, i, n, maxlen;
+    int goodcnt = 0;
+    bool_t limit_set = FALSE;
+    double tcpe = 0.0, acpe, score;
+    job_t *jobs;
+    result_t *results;
+
+    while ((c = getopt(argc, argv, "hqcn:b:j:s:l:a:B:R:I:D:P:f:")) != -1) {
+	switch(c) {
+	case 'h':
+	    usage(argv[0]);
+	    break;
+	case 'q':
+	    verbose = 0;
+	    break;
+	case 'c':
+	    csv = TRUE;
+	    break;
+	case 'n':
+	    blocklen = atoi(optarg);
+	    if (blocklen < 0 || blocklen > MAXBLOCK) {
+		printf("n must be between 0 and %d\n", MAXBLOCK);
+		exit(1);
+	    }
+	    break;
+	case 'b':
+	    bytelim = atoi(optarg);
+	    break;
+	case 'j':
+	    njobs = atoi(optarg);
+	    break;
+	case 's':
+	    seed = (unsigned) strtoul(optarg, NULL, 0);
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    limit_set = TRUE;
+	    break;
+	case 'a':
+	    yas = optarg;
+	    break;
+	case 'B':
+	    if (!bp_set_model(optarg)) {
+		printf("Invalid branch predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'R':
+	    bp_set_ras(atoi(optarg));
+	    break;
+	case 'I':
+	case 'D':
+	    if (!(*(c == 'I' ? &icache : &dcache) = cache_new(optarg))) {
+		printf("Invalid cache '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'P':
+	    miss_penalty = atoi(optarg);
+	    if (miss_penalty < 0) {
+		printf("Invalid miss penalty %d\n", miss_penalty);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'f':
+	    ncopy_name = optarg;
+	    break;
+	default:
+	    printf("Invalid option '%c'\n", c);
+	    usage(argv[0]);
+	    break;
+	}
+    }
+
+    /* The limit is really on cycles, and cache misses add a lot of them */
+    if ((icache || dcache) && !limit_set)
+	instr_limit *= 1 + miss_penalty;
+
+    /*
+     * Timing runs for 0..blocklen, then check runs for 0..blocklen and
+     * the OVER longer lengths tried by correctness.pl.
+     */
+    maxlen = blocklen * (OVER + 1);
+    n = csv ? blocklen + 1 : 2 * (blocklen + 1) + OVER;
+    jobs = (job_t *) malloc(n * sizeof(job_t));
+    results = (result_t *) malloc(n * sizeof(result_t));
+    for (i = 0; i <= blocklen; i++) {
+	jobs[i].len = i;
+	jobs[i].check = FALSE;
+    }
+    for (i = 0; !csv && i <= blocklen + OVER; i++) {
+	job_t *j = &jobs[blocklen + 1 + i];
+	j->len = i <= blocklen ? i : blocklen * (i - blocklen + 1);
+	j->check = TRUE;
+    }
+
+    sim_init();
+    assemble(&drivers[FALSE], maxlen, FALSE);
+    if (!csv)
+	assemble(&drivers[TRUE], maxlen, TRUE);
+    run_jobs(jobs, n, results);
+
+    if (csv) {
+	print_csv(results);
+	exit(0);
+    }
+
+    if (verbose) {
+	/* Named as benchmark.pl names it, without the .ys */
+	int len = strlen(ncopy_name);
+	if (len > 3 && strcmp(ncopy_name + len - 3, ".ys") == 0)
+	    len -= 3;
+	printf("\t%.*s\n", len, ncopy_name);
+    }
+    for (i = 0; i <= blocklen; i++) {
+	result_t *r = &results[i];
+	if (r->status != STAT_HLT)
+	    printf("%d\tSimulation ended with status %s\n",
+		   i, stat_name(r->status));
+	if (i > 0) {
+	    double cpe = (double) r->cycles / i;
+	    if (verbose)
+		printf("%d\t%lld\t%.2f\n", i, r->cycles, cpe);
+	    tcpe += cpe;
+	} else if (verbose) {
+	    printf("%d\t%lld\n", i, r->cycles);
+	}
+    }
+    acpe = blocklen > 0 ? tcpe / blocklen : 0.0;
+    printf("Average CPE\t%.2f\n", acpe);
+
+    score = 0.0;
+    if (acpe <= FULLCPE)
+	score = TOTALPOINTS;
+    else if (acpe <= THRESHCPE)
+	score = TOTALPOINTS * (THRESHCPE - acpe) / (THRESHCPE - FULLCPE);
+    printf("Score\t%.1f/%.1f\n", score, TOTALPOINTS);
+
+    for (i = blocklen + 1; i < n; i++) {
+	result_t *r = &results[i];
+	char *result = check_result(r);
+
+	if (r->rax == CHECK_OK && r->isa_rax == CHECK_OK)
+	    goodcnt++;
+	if (verbose || r->rax == CHECK_LEN)
+	    printf("%d\t%s\n", jobs[i].len, result);
+	if (r->rax == CHECK_LEN)
+	    break;
+    }
+    printf("%d/%d pass correctness test\n", goodcnt, blocklen + OVER + 1);
+
+    free(jobs);
+    free(results);
+    exit(0);
+}
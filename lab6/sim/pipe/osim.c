@@ -0,0 +1,580 @@
+/*
+ * osim.c - Timing model of an out-of-order Y86-64 core
+ *
+ * Estimates how fast a program would run on a superscalar core that
+ * executes out of order, without writing the HCL for one.  The program
+ * is run by the ISA simulator, and each instruction it executes is
+ * then given the cycles in which it is fetched, decoded, dispatched,
+ * executed and retired on a core with these parts:
+ *
+ *   Front end	Fetches and decodes -w instructions a cycle, ending a
+ *		fetch group after any instruction predicted not to fall
+ *		through.  Jumps, calls and rets are predicted by the models
+ *		in bpred.c (-b, -R).  After a misprediction, fetch resumes
+ *		in the cycle after the jump or ret has executed.
+ *   Dispatch	Renames and dispatches -w instructions a cycle, in order,
+ *		each into an entry of the reorder buffer (-r) and its
+ *		micro-operations into the reservation stations (-s).
+ *   Issue	Up to -i micro-operations a cycle, oldest first, once
+ *		their operands are ready and a functional unit of their
+ *		class is free (-u).  Units are pipelined, and a result can
+ *		be used by an operation issued as soon as its latency is
+ *		up.  Loads wait for the last older store to the same
+ *		address, whose data is then forwarded.
+ *   Retire	-w instructions a cycle, in order, once they have executed.
+ *
+ * Instructions are split into micro-operations:
+ *   irmovq, rrmovq, cmovXX, OPq, iaddq	one alu operation
+ *   mrmovq, rmmovq			one mem operation
+ *   pushq, call				an alu operation updating %rsp,
+ *					and a mem operation storing
+ *   popq, ret				an alu operation updating %rsp,
+ *					and a mem operation loading
+ *   jXX				one branch operation
+ * The condition codes are renamed like a register.  jmp, nop and halt
+ * need no functional unit, and a ret resolves when its load does.
+ *
+ * Since only the instructions that really execute are seen, the model
+ * knows every load address and never executes down a wrong path.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "isa.h"
+#include "bpred.h"
+#include "trace.h"
+
+#define MAXWIDTH 16
+#define MAXROB 1024
+#define MAXRS 1024
+#define MAXUNITS 16
+#define MAXLATENCY 64
+
+/* How far past the oldest instruction in flight the functional units
+   can be booked.  Must exceed the longest chain the ROB can hold */
+#define HORIZON (1 << 17)
+
+/* Most micro-operations in one instruction */
+#define MAXUOPS 2
+
+/* Registers as renamed, with the condition codes after the last one.
+   REG_NONE marks an unused operand */
+#define REG_CC (REG_NONE + 1)
+#define NREGS (REG_CC + 1)
+
+typedef enum { U_ALU, U_MEM, U_BRANCH, U_NCLASSES } uclass_t;
+
+static char *class_names[] = { "alu", "mem", "branch" };
+
+typedef struct {
+    uclass_t class;
+    int src[3];             /* Registers, REG_CC or REG_NONE */
+    int dst[2];
+    bool_t load, store;
+} uop_t;
+
+/* isa.c wants to know */
+int gui_mode = FALSE;
+
+/* Parameters modified by the command line */
+int width = 4;               /* Fetch, dispatch and retire width (-w) */
+int issue_width = 4;         /* Micro-operations issued per cycle (-i) */
+int rob_size = 64;           /* Reorder buffer entries (-r) */
+int rs_size = 32;            /* Reservation station entries (-s) */
+int units[U_NCLASSES] = { 2, 1, 1 };    /* Functional units (-u) */
+int latency[U_NCLASSES] = { 1, 2, 1 };  /* ... and their latencies */
+word_t instr_limit = 10000;  /* Instruction limit (-l) */
+int verbosity = 1;           /* Verbosity level (-v) */
+
+/* Bookings of the issue slots and functional units, per cycle.  A slot
+   whose tag is not the cycle asked about is empty */
+static word_t cal_tag[HORIZON];
+static byte_t cal_issued[HORIZON];
+static byte_t cal_busy[HORIZON][U_NCLASSES];
+
+/* Reservation station entries, as a min-heap of the cycles in which
+   their operations issue */
+static word_t rs_heap[MAXRS];
+static int rs_cnt = 0;
+
+/* Cycle in which the last store to each word of memory has its data */
+static word_t store_ready[MEM_SIZE/8];
+
+/* Results */
+static word_t instructions = 0;
+/* Cycles from the first retirement to the last, as psim counts them,
+   and those before the first retirement, from the first fetch on */
+static word_t cycles = 0;
+static word_t fill_cycles = 0;
+static word_t uop_cnt[U_NCLASSES];
+static word_t rob_wait = 0;    /* Instruction-cycles waiting for the ROB */
+static word_t rs_wait = 0;     /* ... and for reservation stations */
+static word_t rob_occupancy = 0;
+static word_t rs_occupancy = 0;
+static word_t retire_hist[MAXWIDTH+1];
+
+/* Book an issue slot and a unit of class c, as early as cycle t */
+static word_t book(uclass_t c, word_t t)
+{
+    for (;; t++) {
+	int slot = t % HORIZON;
+	if (cal_tag[slot] != t) {
+	    cal_tag[slot] = t;
+	    cal_issued[slot] = 0;
+	    memset(cal_busy[slot], 0, sizeof(cal_busy[slot]));
+	}
+	if (cal_issued[slot] < issue_width && cal_busy[slot][c] < units[c]) {
+	    cal_issued[slot]++;
+	    cal_busy[slot][c]++;
+	    return t;
+	}
+    }
+}
+
+static void rs_push(word_t t)
+{
+    int i = rs_cnt++;
+    while (i > 0 && rs_heap[(i-1)/2] > t) {
+	rs_heap[i] = rs_heap[(i-1)/2];
+	i = (i-1)/2;
+    }
+    rs_heap[i] = t;
+}
+
+static void rs_pop()
+{
+    word_t t = rs_heap[--rs_cnt];
+    int i = 0;
+    for (;;) {
+	int c = 2*i + 1;
+	if (c >= rs_cnt)
+	    break;
+	if (c+1 < rs_cnt && rs_heap[c+1] < rs_heap[c])
+	    c++;
+	if (rs_heap[c] >= t)
+	    break;
+	rs_heap[i] = rs_heap[c];
+	i = c;
+    }
+    rs_heap[i] = t;
+}
+
+/* Earliest cycle from t in which n more operations fit in the
+   reservation stations.  An entry is free from the cycle after its
+   operation issues */
+static word_t rs_room(int n, word_t t)
+{
+    while (rs_cnt > 0 && rs_heap[0] < t)
+	rs_pop();
+    while (rs_cnt + n > rs_size) {
+	t = rs_heap[0] + 1;
+	while (rs_cnt > 0 && rs_heap[0] < t)
+	    rs_pop();
+    }
+    return t;
+}
+
+static void set_uop(uop_t *u, uclass_t class, int s0, int s1, int s2,
+		    int d0, int d1)
+{
+    u->class = class;
+    u->src[0] = s0;
+    u->src[1] = s1;
+    u->src[2] = s2;
+    u->dst[0] = d0;
+    u->dst[1] = d1;
+    u->load = u->store = FALSE;
+}
+
+/* Split instruction t into micro-operations.  Returns how many */
+static int crack(trace_ptr t, uop_t *u)
+{
+    int none = REG_NONE;
+    int cc = t->readcc ? REG_CC : none;
+
+    switch (t->icode) {
+    case I_IRMOVQ:
+    case I_RRMOVQ:
+	set_uop(&u[0], U_ALU, t->srca, cc, none, t->dste, none);
+	return 1;
+    case I_ALU:
+    case I_IADDQ:
+	set_uop(&u[0], U_ALU, t->srca, t->srcb, none, t->dste, REG_CC);
+	return 1;
+    case I_MRMOVQ:
+	set_uop(&u[0], U_MEM, t->srcb, none, none, t->dstm, none);
+	u[0].load = TRUE;
+	return 1;
+    case I_RMMOVQ:
+	set_uop(&u[0], U_MEM, t->srca, t->srcb, none, none, none);
+	u[0].store = TRUE;
+	return 1;
+    case I_PUSHQ:
+    case I_CALL:
+	set_uop(&u[0], U_ALU, REG_RSP, none, none, REG_RSP, none);
+	set_uop(&u[1], U_MEM, t->icode == I_PUSHQ ? t->srca : none,
+		REG_RSP, none, none, none);
+	u[1].store = TRUE;
+	return 2;
+    case I_POPQ:
+    case I_RET:
+	set_uop(&u[0], U_ALU, REG_RSP, none, none, REG_RSP, none);
+	set_uop(&u[1], U_MEM, REG_RSP, none, none, t->dstm, none);
+	u[1].load = TRUE;
+	return 2;
+    case I_JMP:
+	if (t->ifun == C_YES)
+	    return 0;
+	set_uop(&u[0], U_BRANCH, REG_CC, none, none, none, none);
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/*
+ * run - Execute the program in s, timing each instruction as it goes.
+ * Returns the status of the last instruction
+ */
+static stat_t run(state_ptr s)
+{
+    /* Fetch, decode, dispatch and retire cycles of recent instructions */
+    word_t *fcyc = calloc(MAXROB, sizeof(word_t));
+    word_t *dcyc = calloc(MAXROB, sizeof(word_t));
+    word_t *pcyc = calloc(MAXROB, sizeof(word_t));
+    word_t *rcyc = calloc(MAXROB, sizeof(word_t));
+    /* Cycle from which each renamed register can be used */
+    word_t reg_ready[NREGS] = { 0 };
+    word_t next_f = 0;
+    word_t first_r = 0, prev_r = 0;
+    int group = 0;
+    stat_t status = STAT_AOK;
+    word_t n;
+
+    memset(store_ready, 0, sizeof(store_ready));
+    for (n = 0; n < instr_limit && status == STAT_AOK; n++) {
+	trace_rec t;
+	uop_t u[MAXUOPS];
+	word_t ready[NREGS];
+	int nuops, k, j;
+	word_t f, d, p, done, r, t0, resolve, predpc;
+	word_t issue[MAXUOPS];
+	word_t back = n >= width ? (n - width) % MAXROB : 0;
+
+	status = trace_step(s, &t);
+	nuops = crack(&t, u);
+
+	/* Fetch and decode, with room ahead of them */
+	f = next_f;
+	if (n > 0 && fcyc[(n-1) % MAXROB] > f)
+	    f = fcyc[(n-1) % MAXROB];
+	if (n >= width) {
+	    if (fcyc[back] + 1 > f)
+		f = fcyc[back] + 1;
+	    if (dcyc[back] > f)
+		f = dcyc[back];
+	}
+	trace_resolve_before(f);
+	predpc = bp_predict(t.pc, t.icode, t.ifun, t.valc, t.valp);
+	if (status == STAT_AOK)
+	    bp_fetched(t.icode, t.valp);
+	d = f + 1;
+	if (n > 0 && dcyc[(n-1) % MAXROB] > d)
+	    d = dcyc[(n-1) % MAXROB];
+	if (n >= width) {
+	    if (dcyc[back] + 1 > d)
+		d = dcyc[back] + 1;
+	    if (pcyc[back] > d)
+		d = pcyc[back];
+	}
+
+	/* Dispatch, once there is room in the ROB and stations */
+	p = d + 1;
+	if (n > 0 && pcyc[(n-1) % MAXROB] > p)
+	    p = pcyc[(n-1) % MAXROB];
+	if (n >= width && pcyc[back] + 1 > p)
+	    p = pcyc[back] + 1;
+	t0 = p;
+	if (n >= rob_size && rcyc[(n - rob_size) % MAXROB] + 1 > p)
+	    p = rcyc[(n - rob_size) % MAXROB] + 1;
+	rob_wait += p - t0;
+	t0 = p;
+	p = rs_room(nuops, p);
+	rs_wait += p - t0;
+
+	/* Issue and execute.  Every operation reads the registers as they
+	   were before the instruction */
+	memcpy(ready, reg_ready, sizeof(ready));
+	done = p + 1;
+	resolve = p + 1;
+	for (k = 0; k < nuops; k++) {
+	    word_t at = p + 1;
+	    word_t c;
+	    for (j = 0; j < 3; j++) {
+		int reg = u[k].src[j];
+		if (reg < NREGS && reg != REG_NONE && ready[reg] > at)
+		    at = ready[reg];
+	    }
+	    if (u[k].load) {
+		word_t a = t.addr;
+		if (a >= 0 && a < MEM_SIZE) {
+		    if (store_ready[a/8] > at)
+			at = store_ready[a/8];
+		    if ((a+7)/8 < MEM_SIZE/8 && store_ready[(a+7)/8] > at)
+			at = store_ready[(a+7)/8];
+		}
+	    }
+	    issue[k] = book(u[k].class, at);
+	    c = issue[k] + latency[u[k].class];
+	    uop_cnt[u[k].class]++;
+	    rs_push(issue[k]);
+	    rs_occupancy += issue[k] - p;
+	    for (j = 0; j < 2; j++) {
+		int reg = u[k].dst[j];
+		if (reg < NREGS && reg != REG_NONE)
+		    reg_ready[reg] = c;
+	    }
+	    if (u[k].store) {
+		word_t a = t.addr;
+		if (a >= 0 && a < MEM_SIZE) {
+		    store_ready[a/8] = c;
+		    if ((a+7)/8 < MEM_SIZE/8)
+			store_ready[(a+7)/8] = c;
+		}
+	    }
+	    if (c > done)
+		done = c;
+	    if (u[k].class == U_BRANCH || u[k].load)
+		resolve = c;
+	}
+
+	/* Retire */
+	r = done;
+	if (n > 0 && rcyc[(n-1) % MAXROB] > r)
+	    r = rcyc[(n-1) % MAXROB];
+	if (n >= width && rcyc[back] + 1 > r)
+	    r = rcyc[back] + 1;
+	rob_occupancy += r - p;
+
+	if (verbosity >= 2) {
+	    printf("0x%03llx: %-7s F %5lld  D %5lld  P %5lld  I", t.pc,
+		   iname(HPACK(t.icode, t.ifun)), f, d, p);
+	    for (k = 0; k < MAXUOPS; k++)
+		if (k < nuops)
+		    printf(" %5lld", issue[k]);
+		else
+		    printf("      ");
+	    printf("  R %5lld\n", r);
+	}
+
+	/* Statistics */
+	if (n == 0) {
+	    first_r = r;
+	    group = 1;
+	} else if (r == prev_r) {
+	    group++;
+	} else {
+	    retire_hist[group]++;
+	    retire_hist[0] += r - prev_r - 1;
+	    group = 1;
+	}
+
+	fcyc[n % MAXROB] = f;
+	dcyc[n % MAXROB] = d;
+	pcyc[n % MAXROB] = p;
+	rcyc[n % MAXROB] = r;
+	prev_r = r;
+
+	/* Where the next instruction is fetched from, and when */
+	if (status == STAT_AOK && (t.icode == I_JMP || t.icode == I_RET))
+	    trace_resolve_at(&t, predpc, resolve);
+	if (status == STAT_AOK && predpc != t.next_pc)
+	    next_f = resolve;
+	else if (predpc != t.valp)
+	    next_f = f + 1;
+	else
+	    next_f = f;
+    }
+    trace_resolve_before(prev_r + 1);
+
+    instructions = n;
+    if (n > 0) {
+	cycles = prev_r - first_r + 1;
+	fill_cycles = first_r;
+	retire_hist[group]++;
+    }
+    free(fcyc);
+    free(dcyc);
+    free(pcyc);
+    free(rcyc);
+    return status;
+}
+
+static void report(stat_t status)
+{
+    int k;
+
+    if (verbosity >= 1) {
+	printf("%d-wide, issue %d, ROB %d, RS %d, units", width, issue_width,
+	       rob_size, rs_size);
+	for (k = 0; k < U_NCLASSES; k++)
+	    printf(" %s:%d:%d", class_names[k], units[k], latency[k]);
+	printf(": %lld instructions, status %s\n", instructions,
+	       stat_name(status));
+    }
+    printf("CPI: %lld cycles/%lld instructions = %.2f\n", cycles, instructions,
+	   instructions > 0 ? (double) cycles / instructions : 1.0);
+    printf("Steady state: cycles counted from the first retirement, as psim"
+	   " does; %lld from the first fetch\n", cycles + fill_cycles);
+    if (verbosity < 1 || cycles == 0)
+	return;
+    printf("Instructions retired per cycle:\n");
+    for (k = width; k >= 0; k--)
+	printf("  %2d: %8lld cycles (%5.1f%%)\n", k, retire_hist[k],
+	       100.0 * retire_hist[k] / cycles);
+    printf("Average occupancy: ROB %.1f, RS %.1f\n",
+	   (double) rob_occupancy / cycles, (double) rs_occupancy / cycles);
+    printf("Dispatch waited %lld cycles for the ROB, %lld for the RS\n",
+	   rob_wait, rs_wait);
+    printf("Functional unit use:\n");
+    for (k = 0; k < U_NCLASSES; k++)
+	printf("  %-7s %8lld operations (%5.1f%% busy)\n", class_names[k],
+	       uop_cnt[k], 100.0 * uop_cnt[k] / ((double) units[k] * cycles));
+    bp_report(stdout);
+}
+
+/* Set a class of functional units from a string CLASS:COUNT:LATENCY */
+static bool_t set_units(char *spec)
+{
+    char name[16];
+    int count, lat;
+    int k;
+
+    if (sscanf(spec, "%15[^:]:%d:%d", name, &count, &lat) != 3 ||
+	count < 1 || count > MAXUNITS || lat < 1 || lat > MAXLATENCY)
+	return FALSE;
+    for (k = 0; k < U_NCLASSES; k++)
+	if (strcmp(name, class_names[k]) == 0) {
+	    units[k] = count;
+	    latency[k] = lat;
+	    return TRUE;
+	}
+    return FALSE;
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-h] [-w n] [-i n] [-r n] [-s n] [-u units] [-l m] [-v n]\n",
+	   name);
+    printf("       [-b model] [-R n] file.yo\n");
+    printf("   -h     Print this message\n");
+    printf("   -w n   Fetch, dispatch and retire n <= %d instructions per cycle (default %d)\n",
+	   MAXWIDTH, width);
+    printf("   -i n   Issue n <= %d operations per cycle (default %d)\n",
+	   MAXWIDTH, issue_width);
+    printf("   -r n   Give the reorder buffer n <= %d entries (default %d)\n",
+	   MAXROB, rob_size);
+    printf("   -s n   Give the reservation stations n <= %d entries (default %d)\n",
+	   MAXRS, rs_size);
+    printf("   -u u   Set a class of units, u = class:count:latency, where class is\n");
+    printf("          alu, mem or branch (default alu:%d:%d, mem:%d:%d, branch:%d:%d)\n",
+	   units[U_ALU], latency[U_ALU], units[U_MEM], latency[U_MEM],
+	   units[U_BRANCH], latency[U_BRANCH]);
+    printf("   -l m   Set instruction limit to m (default %lld)\n", instr_limit);
+    printf("   -v n   Set verbosity level to 0 <= n <= 2 (default %d)\n",
+	   verbosity);
+    printf("   -b m   Set branch predictor to m: taken, nt, btfnt, 2bit[:n] or gshare[:n]\n");
+    printf("   -R n   Give branch predictor an n-entry return address stack\n");
+    exit(0);
+}
+
+/* Parse a count between 1 and max for option c */
+static int get_count(char c, char *arg, int max, char *name)
+{
+    int n = atoi(arg);
+    if (n < 1 || n > max) {
+	printf("Invalid -%c %s\n", c, arg);
+	usage(name);
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *object_file;
+    state_ptr s;
+    stat_t status;
+    int c;
+
+    while ((c = getopt(argc, argv, "hw:i:r:s:u:l:v:b:R:")) != -1) {
+	switch(c) {
+	case 'w':
+	    width = get_count(c, optarg, MAXWIDTH, argv[0]);
+	    break;
+	case 'i':
+	    issue_width = get_count(c, optarg, MAXWIDTH, argv[0]);
+	    break;
+	case 'r':
+	    rob_size = get_count(c, optarg, MAXROB, argv[0]);
+	    break;
+	case 's':
+	    rs_size = get_count(c, optarg, MAXRS, argv[0]);
+	    break;
+	case 'u':
+	    if (!set_units(optarg)) {
+		printf("Invalid functional units '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'v':
+	    verbosity = atoi(optarg);
+	    if (verbosity < 0 || verbosity > 2) {
+		printf("Invalid verbosity %d\n", verbosity);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'b':
+	    if (!bp_set_model(optarg)) {
+		printf("Invalid branch predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'R':
+	    bp_set_ras(atoi(optarg));
+	    break;
+	case 'h':
+	default:
+	    usage(argv[0]);
+	    break;
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+    if (rs_size < MAXUOPS) {
+	printf("The reservation stations need at least %d entries\n", MAXUOPS);
+	usage(argv[0]);
+    }
+    object_file = fopen(argv[optind], "r");
+    if (!object_file) {
+	fprintf(stderr, "Couldn't open object file %s\n", argv[optind]);
+	exit(1);
+    }
+
+    s = new_state(MEM_SIZE);
+    if (!load_mem(s->m, object_file, 1)) {
+	fprintf(stderr, "No lines of code found\n");
+	exit(1);
+    }
+    fclose(object_file);
+
+    status = run(s);
+    report(status);
+    free_state(s);
+    return 0;
+}
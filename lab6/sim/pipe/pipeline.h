@@ -25,14 +25,12 @@
 
 typedef enum { P_LOAD, P_STALL, P_BUBBLE, P_ERROR } p_stat_t;
 
+/* Control for one pipeline register.  The register state itself lives
+   in two typed copies (see pipe_regs_t in stages.h); curr selects the
+   one holding the current state, and the other one holds the next state */
 typedef struct {
-    /* Current and next register state */
-    void *current;
-    void *next;
-    /* Contents of register when bubble occurs */
-    void *bubble_val;
-    /* Number of state bytes */
-    int count;
+    /* Which copy holds the current state (0 or 1) */
+    int curr;
     /* How should state be updated next time? */
     p_stat_t op;
 } pipe_ele, *pipe_ptr;
@@ -41,10 +39,6 @@ typedef struct {
  *	function declarations
  ******************************************************************************/
 
-/* Create new pipe with count bytes of state */
-/* bubble_val indicates state corresponding to pipeline bubble */
-pipe_ptr new_pipe(int count, void *bubble_val);
-
 /* Update all pipes */
 void update_pipes();
 
@@ -10,11 +10,15 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <stddef.h>
 
 #include "isa.h"
 #include "pipeline.h"
 #include "stages.h"
 #include "sim.h"
+#include "bpred.h"
+#include "cache.h"
+#include "vcd.h"
 
 #define MAXBUF 1024
 #define DEFAULTNAME "Y86-64 Simulator: "
@@ -43,6 +47,13 @@ FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
+bool_t hazard_stats = FALSE; /* Attribute bubbles to hazards? (-s) */
+bool_t hazard_by_pc = FALSE; /* ... and to instruction addresses? (-p) */
+cache_t icache = NULL;   /* Instruction cache, NULL for none (-I) */
+cache_t dcache = NULL;   /* Data cache, NULL for none (-D) */
+int miss_penalty = 10;   /* Stall cycles per block moved by a cache (-P) */
+char *wave_file = NULL;  /* Waveform output file, NULL for none (-V) */
+char *wave_signals = "*"; /* Signals written to it (-W) */
 
 /************* 
  * End Globals 
@@ -54,8 +65,15 @@ bool_t do_check = FALSE; /* Test with ISA simulator? [TTY only] (-t) */
  ***************************/
 
 word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *ccp);
+#ifndef NO_SIM_MAIN
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+static bool_t wave_open(char *fname, char *signals); /* Start waveform file */
+static void wave_close();                /* Finish waveform file */
+#endif /* NO_SIM_MAIN */
+static void shift_tags();                /* Move bubble tags with pipes */
+static void wave_sample(word_t cyc);     /* Add a cycle to waveform file */
+static void charge_bubble();             /* Charge a lost cycle to a tag */
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -70,9 +88,12 @@ void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands *
  * Part 1: This part is the initial entry point that handles general
  * initialization. It parses the command line and does any necessary
  * setup to run in either TTY or GUI mode, and then starts the
- * simulation.
+ * simulation.  Programs that drive the simulator themselves (nbench)
+ * compile with NO_SIM_MAIN and supply their own sim_main.
  *******************************************************************/
 
+#ifndef NO_SIM_MAIN
+
 /* 
  * sim_main - main simulator routine. This function is called from the
  * main() routine in the HCL file.
@@ -84,7 +105,7 @@ int sim_main(int argc, char **argv)
     char *myargv[MAXARGS];
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "htgspl:v:b:R:I:D:P:V:W:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -102,6 +123,41 @@ int sim_main(int argc, char **argv)
 	case 't':
 	    do_check = TRUE;
 	    break;
+	case 'b':
+	    if (!bp_set_model(optarg)) {
+		printf("Invalid branch predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'R':
+	    bp_set_ras(atoi(optarg));
+	    break;
+	case 'I':
+	case 'D':
+	    if (!(*(c == 'I' ? &icache : &dcache) = cache_new(optarg))) {
+		printf("Invalid cache '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'P':
+	    miss_penalty = atoi(optarg);
+	    if (miss_penalty < 0) {
+		printf("Invalid miss penalty %d\n", miss_penalty);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'V':
+	    wave_file = optarg;
+	    break;
+	case 'W':
+	    wave_signals = optarg;
+	    break;
+	case 'p':
+	    hazard_by_pc = TRUE;
+	    /* Fall through */
+	case 's':
+	    hazard_stats = TRUE;
+	    break;
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
@@ -150,6 +206,13 @@ int sim_main(int argc, char **argv)
 	    usage(argv[0]);
 	}
 
+	/* The GUI can reset the simulation, which a waveform file
+	   can't follow */
+	if (wave_file) {
+	    printf("Waveforms (-V) can't be written in GUI mode\n");
+	    usage(argv[0]);
+	}
+
 	/* Build the command line for the GUI simulator */
 	for (i = 0; i < TKARGS; i++) {
 	    if ((myargv[i] = malloc(MAXBUF*sizeof(char))) == NULL) {
@@ -196,6 +259,8 @@ static void run_tty_sim()
     if (verbosity >= 2)
 	sim_set_dumpfile(stdout);
     sim_init();
+    if (wave_file && !wave_open(wave_file, wave_signals))
+	exit(1);
 
     /* Emit simulator name */
     if (verbosity >= 2)
@@ -274,7 +339,16 @@ static void run_tty_sim()
 	printf("CPI: %lld cycles/%lld instructions = %.2f\n",
 	       cycles, instructions, cpi);
     }
-
+    if (hazard_stats)
+	report_hazards();
+    if (bp_active)
+	bp_report(stdout);
+    if (icache)
+	cache_report(stdout, "I-cache", icache);
+    if (dcache)
+	cache_report(stdout, "D-cache", dcache);
+    if (wave_file)
+	wave_close();
 }
 
 /*
@@ -282,16 +356,30 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgsp] [-l m] [-v n] [-b model] [-R n]\n", name);
+    printf("       [-I cache] [-D cache] [-P n] [-V file] [-W sigs] file.yo\n");
     printf("file.yo arg required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
     printf("   -t     Test result against ISA simulator [TTY mode only]\n");
+    printf("   -s     Break down cycles by the hazards that caused bubbles [TTY mode only]\n");
+    printf("   -p     As -s, and also by instruction address [TTY mode only]\n");
+    printf("   -b m   Set branch predictor to m: taken, nt, btfnt, 2bit[:n] or gshare[:n]\n");
+    printf("   -R n   Give branch predictor an n-entry return address stack\n");
+    printf("          (-b and -R only affect VERSION=bp)\n");
+    printf("   -I c   Model an instruction cache c = size:assoc:block[:lru|random]\n");
+    printf("   -D c   Model a data cache, described as for -I\n");
+    printf("   -P n   Stall n cycles for each block a cache moves (default %d)\n",
+	   miss_penalty);
+    printf("   -V f   Write waveforms of pipeline signals to VCD file f [TTY mode only]\n");
+    printf("   -W s   Only include signals s, e.g. 'E_*,M_valE,f_pc' (default all)\n");
     exit(0);
 }
 
+#endif /* NO_SIM_MAIN */
+
 
 /*********************************************************
  * Part 2: This part contains the core simulator routines.
@@ -311,6 +399,41 @@ word_t instructions = 0;
 /* Has simulator gotten past initial bubbles? */
 static int starting_up = 1;
 
+/* Bubble attribution.  When hazard_stats is set, each bubble injected
+   into a pipe register is tagged with the hazard that caused it and the
+   address of the instruction responsible, and the tag moves down the
+   pipeline with the bubble.  Every cycle after start-up in which WB
+   holds no instruction is charged to the tag found there */
+typedef enum { H_NONE, H_LOADUSE, H_MISPRED, H_RET, H_DATA, H_EXCEPT,
+	       H_ICACHE, H_DCACHE, H_OTHER, H_NCAUSE } hazard_t;
+
+typedef struct {
+    hazard_t cause;
+    word_t pc;
+} hazard_tag;
+
+static char *hazard_names[H_NCAUSE] =
+    { "none", "load/use", "mispredict", "ret", "data", "exception",
+      "icache", "dcache", "other" };
+
+/* Tags of current pipe register contents, and of bubbles being injected */
+static hazard_tag pipe_tags[WB_STAGE+1];
+static hazard_tag bubble_tags[WB_STAGE+1];
+/* Cycles charged to each hazard, in total and per instruction address */
+static word_t hazard_cycles[H_NCAUSE];
+static word_t (*hazard_pc_cycles)[H_NCAUSE] = NULL;
+
+/* Cache misses.  While a block is being moved, the fetch stage feeds
+   bubbles into decode (fetch_held), or the memory stage holds everything
+   behind it and feeds bubbles into write-back (mem_held).  The waits
+   count down the cycles still to go */
+static int fetch_wait = 0;
+static int mem_wait = 0;
+static word_t fetch_addr = -1;   /* Address last looked up in the I-cache */
+static bool_t fetch_held = FALSE;
+static bool_t fetch_bubble = FALSE; /* Bubble in D is due to fetch_held */
+static bool_t mem_held = FALSE;
+
 
 
 /* Both instruction and data memory */
@@ -367,6 +490,8 @@ bool_t e_bcond;
 bool_t dmem_error;
 
 /* The pipeline state */
+pipe_regs_t pipe_regs;
+static pipe_ele pipes[WB_STAGE+1];
 pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
 
 /* Simulator operating mode */
@@ -532,29 +657,15 @@ void sim_init()
     initialized = 1;
     mem = init_mem(MEM_SIZE);
     reg = init_reg();
+    if (hazard_by_pc && !hazard_pc_cycles)
+	hazard_pc_cycles = calloc(MEM_SIZE, sizeof(*hazard_pc_cycles));
     
     /* create 5 pipe registers */
-    pc_state     = new_pipe(sizeof(pc_ele), (void *) &bubble_pc);
-    if_id_state  = new_pipe(sizeof(if_id_ele), (void *) &bubble_if_id);
-    id_ex_state  = new_pipe(sizeof(id_ex_ele), (void *) &bubble_id_ex);
-    ex_mem_state = new_pipe(sizeof(ex_mem_ele), (void *) &bubble_ex_mem);
-    mem_wb_state = new_pipe(sizeof(mem_wb_ele), (void *) &bubble_mem_wb);
-  
-    /* connect them to the pipeline stages */
-    pc_next   = pc_state->next;
-    pc_curr   = pc_state->current;
-  
-    if_id_next = if_id_state->next;
-    if_id_curr = if_id_state->current;
-
-    id_ex_next = id_ex_state->next;
-    id_ex_curr = id_ex_state->current;
-
-    ex_mem_next = ex_mem_state->next;
-    ex_mem_curr = ex_mem_state->current;
-
-    mem_wb_next = mem_wb_state->next;
-    mem_wb_curr = mem_wb_state->current;
+    pc_state     = &pipes[IF_STAGE];
+    if_id_state  = &pipes[ID_STAGE];
+    id_ex_state  = &pipes[EX_STAGE];
+    ex_mem_state = &pipes[MEM_STAGE];
+    mem_wb_state = &pipes[WB_STAGE];
 
     sim_reset();
     clear_mem(mem);
@@ -570,6 +681,19 @@ void sim_reset()
     memCnt = 0;
     starting_up = 1;
     cycles = instructions = 0;
+    memset(pipe_tags, 0, sizeof(pipe_tags));
+    memset(bubble_tags, 0, sizeof(bubble_tags));
+    memset(hazard_cycles, 0, sizeof(hazard_cycles));
+    if (hazard_pc_cycles)
+	memset(hazard_pc_cycles, 0, MEM_SIZE * sizeof(*hazard_pc_cycles));
+    bp_reset();
+    if (icache)
+	cache_reset(icache);
+    if (dcache)
+	cache_reset(dcache);
+    fetch_wait = mem_wait = 0;
+    fetch_addr = -1;
+    fetch_held = fetch_bubble = mem_held = FALSE;
     cc = DEFAULT_CC;
     status = STAT_AOK;
 
@@ -680,6 +804,183 @@ void tty_report(word_t cyc) {
 	  stat_name(mem_wb_curr->status));
 }
 
+/*
+ * Waveforms (-V).  Every cycle, the selected signals are looked up and
+ * handed to the VCD writer, which only writes the ones that changed.
+ * Pipe register fields show the current state, under their HCL names,
+ * and the stall and bubble signals show what happens to each register
+ * at the end of the cycle.
+ */
+#define WAVE_GLOBAL (WB_STAGE+1)  /* Signal is a global variable */
+#define WAVE_STALL  (WB_STAGE+2)  /* Register is stalled */
+#define WAVE_BUBBLE (WB_STAGE+3)  /* Register is given a bubble */
+
+typedef struct {
+    char *name;      /* HCL name */
+    int width;       /* Bits in waveform */
+    int where;       /* Pipe register holding it, or one of the above */
+    size_t off;      /* Offset of field in pipe register */
+    int size;        /* Bytes in field or global */
+    void *addr;      /* Address of global, or pipe_ptr for stall/bubble */
+    int id;          /* Number in waveform file, or -1 if not written */
+} wave_sig;
+
+#define WAVE_REG(name, width, stage, type, field) \
+    { name, width, stage, offsetof(type, field), \
+      sizeof(((type *) 0)->field), NULL, -1 }
+#define WAVE_VAR(name, width, var) \
+    { name, width, WAVE_GLOBAL, 0, sizeof(var), &var, -1 }
+#define WAVE_CTL(name, kind, state) \
+    { name, 1, kind, 0, 0, &state, -1 }
+
+static wave_sig wave_sigs[] = {
+    WAVE_REG("F_predPC", 64, IF_STAGE, pc_ele, pc),
+    WAVE_REG("D_stat", 3, ID_STAGE, if_id_ele, status),
+    WAVE_REG("D_pc", 64, ID_STAGE, if_id_ele, stage_pc),
+    WAVE_REG("D_icode", 4, ID_STAGE, if_id_ele, icode),
+    WAVE_REG("D_ifun", 4, ID_STAGE, if_id_ele, ifun),
+    WAVE_REG("D_rA", 4, ID_STAGE, if_id_ele, ra),
+    WAVE_REG("D_rB", 4, ID_STAGE, if_id_ele, rb),
+    WAVE_REG("D_valC", 64, ID_STAGE, if_id_ele, valc),
+    WAVE_REG("D_valP", 64, ID_STAGE, if_id_ele, valp),
+    WAVE_REG("E_stat", 3, EX_STAGE, id_ex_ele, status),
+    WAVE_REG("E_pc", 64, EX_STAGE, id_ex_ele, stage_pc),
+    WAVE_REG("E_icode", 4, EX_STAGE, id_ex_ele, icode),
+    WAVE_REG("E_ifun", 4, EX_STAGE, id_ex_ele, ifun),
+    WAVE_REG("E_valC", 64, EX_STAGE, id_ex_ele, valc),
+    WAVE_REG("E_valA", 64, EX_STAGE, id_ex_ele, vala),
+    WAVE_REG("E_valB", 64, EX_STAGE, id_ex_ele, valb),
+    WAVE_REG("E_srcA", 4, EX_STAGE, id_ex_ele, srca),
+    WAVE_REG("E_srcB", 4, EX_STAGE, id_ex_ele, srcb),
+    WAVE_REG("E_dstE", 4, EX_STAGE, id_ex_ele, deste),
+    WAVE_REG("E_dstM", 4, EX_STAGE, id_ex_ele, destm),
+    WAVE_REG("M_stat", 3, MEM_STAGE, ex_mem_ele, status),
+    WAVE_REG("M_pc", 64, MEM_STAGE, ex_mem_ele, stage_pc),
+    WAVE_REG("M_icode", 4, MEM_STAGE, ex_mem_ele, icode),
+    WAVE_REG("M_ifun", 4, MEM_STAGE, ex_mem_ele, ifun),
+    WAVE_REG("M_Cnd", 1, MEM_STAGE, ex_mem_ele, takebranch),
+    WAVE_REG("M_valE", 64, MEM_STAGE, ex_mem_ele, vale),
+    WAVE_REG("M_valA", 64, MEM_STAGE, ex_mem_ele, vala),
+    WAVE_REG("M_dstE", 4, MEM_STAGE, ex_mem_ele, deste),
+    WAVE_REG("M_dstM", 4, MEM_STAGE, ex_mem_ele, destm),
+    WAVE_REG("W_stat", 3, WB_STAGE, mem_wb_ele, status),
+    WAVE_REG("W_pc", 64, WB_STAGE, mem_wb_ele, stage_pc),
+    WAVE_REG("W_icode", 4, WB_STAGE, mem_wb_ele, icode),
+    WAVE_REG("W_valE", 64, WB_STAGE, mem_wb_ele, vale),
+    WAVE_REG("W_valM", 64, WB_STAGE, mem_wb_ele, valm),
+    WAVE_REG("W_dstE", 4, WB_STAGE, mem_wb_ele, deste),
+    WAVE_REG("W_dstM", 4, WB_STAGE, mem_wb_ele, destm),
+    WAVE_VAR("f_pc", 64, f_pc),
+    WAVE_VAR("imem_error", 1, imem_error),
+    WAVE_VAR("instr_valid", 1, instr_valid),
+    WAVE_VAR("e_Cnd", 1, e_bcond),
+    WAVE_VAR("dmem_error", 1, dmem_error),
+    WAVE_VAR("mem_addr", 64, mem_addr),
+    WAVE_VAR("mem_write", 1, mem_write),
+    WAVE_VAR("cc", 3, cc),
+    WAVE_VAR("Stat", 3, status),
+    WAVE_CTL("F_stall", WAVE_STALL, pc_state),
+    WAVE_CTL("D_stall", WAVE_STALL, if_id_state),
+    WAVE_CTL("D_bubble", WAVE_BUBBLE, if_id_state),
+    WAVE_CTL("E_bubble", WAVE_BUBBLE, id_ex_state),
+    WAVE_CTL("M_bubble", WAVE_BUBBLE, ex_mem_state),
+    WAVE_CTL("W_stall", WAVE_STALL, mem_wb_state),
+};
+
+#define WAVE_NSIGS (sizeof(wave_sigs) / sizeof(wave_sig))
+
+/* Waveform file, NULL if none */
+static vcd_t wave = NULL;
+
+#ifndef NO_SIM_MAIN
+/* Does name match one of the comma-separated patterns?  A pattern
+   ending in '*' matches any name starting with the rest of it */
+static bool_t wave_match(char *name, char *patterns)
+{
+    char *p = patterns;
+    while (*p) {
+	size_t len = strcspn(p, ",");
+	if (len > 0 && p[len-1] == '*') {
+	    if (strncmp(name, p, len-1) == 0)
+		return TRUE;
+	} else if (strlen(name) == len && strncmp(name, p, len) == 0)
+	    return TRUE;
+	p += len;
+	if (*p == ',')
+	    p++;
+    }
+    return FALSE;
+}
+
+/* Create waveform file fname with the signals matching signals.
+   Returns FALSE, after saying why, if that can't be done */
+static bool_t wave_open(char *fname, char *signals)
+{
+    int i, cnt = 0;
+    wave = vcd_open(fname, "pipe");
+    if (!wave) {
+	fprintf(stderr, "Couldn't create waveform file %s\n", fname);
+	return FALSE;
+    }
+    for (i = 0; i < WAVE_NSIGS; i++) {
+	wave_sigs[i].id = -1;
+	if (wave_match(wave_sigs[i].name, signals)) {
+	    wave_sigs[i].id = vcd_add(wave, wave_sigs[i].name,
+				      wave_sigs[i].width);
+	    cnt++;
+	}
+    }
+    if (cnt == 0) {
+	fprintf(stderr, "No signals match '%s'\n", signals);
+	vcd_close(wave);
+	wave = NULL;
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static void wave_close()
+{
+    if (wave)
+	vcd_close(wave);
+    wave = NULL;
+}
+#endif /* NO_SIM_MAIN */
+
+/* Value of signal w in the current cycle */
+static word_t wave_value(wave_sig *w)
+{
+    char *p;
+    switch (w->where) {
+    case IF_STAGE:  p = (char *) pc_curr; break;
+    case ID_STAGE:  p = (char *) if_id_curr; break;
+    case EX_STAGE:  p = (char *) id_ex_curr; break;
+    case MEM_STAGE: p = (char *) ex_mem_curr; break;
+    case WB_STAGE:  p = (char *) mem_wb_curr; break;
+    case WAVE_STALL:
+	return (*(pipe_ptr *) w->addr)->op == P_STALL;
+    case WAVE_BUBBLE:
+	return (*(pipe_ptr *) w->addr)->op == P_BUBBLE;
+    default:
+	p = (char *) w->addr;
+	break;
+    }
+    p += w->off;
+    switch (w->size) {
+    case 1:  return *(unsigned char *) p;
+    case 4:  return *(unsigned int *) p;
+    default: return *(word_t *) p;
+    }
+}
+
+static void wave_sample(word_t cyc)
+{
+    int i;
+    for (i = 0; i < WAVE_NSIGS; i++)
+	if (wave_sigs[i].id >= 0)
+	    vcd_change(wave, cyc, wave_sigs[i].id, wave_value(&wave_sigs[i]));
+}
+
 /* Run pipeline for one cycle */
 /* Return status of processor */
 /* Max_instr indicates maximum number of instructions that
@@ -697,8 +998,11 @@ static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
     /* Update program-visible state */
     update_state(update_mem, update_cc);
     /* Update pipe registers */
+    if (hazard_stats)
+	shift_tags();
     update_pipes();
-    tty_report(ccount);
+    if (dumpfile)
+	tty_report(ccount);
     if (pc_state->op == P_ERROR)
 	pc_curr->status = STAT_PIP;
     if (if_id_state->op == P_ERROR)
@@ -734,11 +1038,16 @@ static byte_t sim_step_pipe(word_t max_instr, word_t ccount)
 	instructions++;
 	cycles++;
     } else {
-	if (!starting_up)
+	if (!starting_up) {
 	    cycles++;
+	    if (hazard_stats)
+		charge_bubble();
+	}
     }
     
     sim_report();
+    if (wave)
+	wave_sample(ccount);
     return status;
 }
 
@@ -1243,79 +1552,265 @@ int Tcl_AppInit(Tcl_Interp *interp)
  *************************************************************/
 
 /******************************************************************************
- *	defines
+ *	function definitions
  ******************************************************************************/
 
-#define MAX_STAGE 10
+/* Point the current and next state pointers at the copies selected by
+   each pipe's curr index */
+static void connect_pipes()
+{
+    int c;
 
-/******************************************************************************
- *	static variables
- ******************************************************************************/
+    c = pc_state->curr;
+    pc_curr = &pipe_regs.pc[c];
+    pc_next = &pipe_regs.pc[c^1];
 
-static pipe_ptr pipes[MAX_STAGE];
-static int pipe_count = 0;
+    c = if_id_state->curr;
+    if_id_curr = &pipe_regs.if_id[c];
+    if_id_next = &pipe_regs.if_id[c^1];
 
-/******************************************************************************
- *	function definitions
- ******************************************************************************/
+    c = id_ex_state->curr;
+    id_ex_curr = &pipe_regs.id_ex[c];
+    id_ex_next = &pipe_regs.id_ex[c^1];
 
-/* Create new pipe with count bytes of state */
-/* bubble_val indicates state corresponding to pipeline bubble */
-pipe_ptr new_pipe(int count, void *bubble_val)
-{
-  pipe_ptr result = (pipe_ptr) malloc(sizeof(pipe_ele));
-  result->current = malloc(count);
-  result->next = malloc(count);
-  memcpy(result->current, bubble_val, count);
-  memcpy(result->next, bubble_val, count);
-  result->count = count;
-  result->op = P_LOAD;
-  result->bubble_val = bubble_val;
-  pipes[pipe_count++] = result; 
-  return result;
+    c = ex_mem_state->curr;
+    ex_mem_curr = &pipe_regs.ex_mem[c];
+    ex_mem_next = &pipe_regs.ex_mem[c^1];
+
+    c = mem_wb_state->curr;
+    mem_wb_curr = &pipe_regs.mem_wb[c];
+    mem_wb_next = &pipe_regs.mem_wb[c^1];
 }
 
-/* Update all pipes */
-void update_pipes()
+/* Apply the pending operation to pipe p.
+   Return TRUE if its current state must be set to the bubble value */
+static inline bool_t update_pipe(pipe_ptr p)
 {
-  int s;
-  for (s = 0; s < pipe_count; s++) {
-    pipe_ptr p = pipes[s];
+    bool_t bubble = FALSE;
     switch (p->op)
       {
       case P_BUBBLE:
-      	/* insert a bubble into the next stage */
-      	memcpy(p->current, p->bubble_val, p->count);
-      	break;
-      
+	/* insert a bubble into the next stage */
+	bubble = TRUE;
+	break;
       case P_LOAD:
-      	/* copy calculated state from previous stage */
-      	memcpy(p->current, p->next, p->count);
-      	break;
+	/* calculated state from previous stage becomes current */
+	p->curr ^= 1;
+	break;
       case P_ERROR:
-	  /* Like a bubble, but insert error condition */
-      	memcpy(p->current, p->bubble_val, p->count);
-      	break;
+	/* Like a bubble, but insert error condition */
+	bubble = TRUE;
+	break;
       case P_STALL:
       default:
-      	/* do nothing: next stage gets same instr again */
-      	;
+	/* do nothing: next stage gets same instr again */
+	;
       }
     if (p->op != P_ERROR)
 	p->op = P_LOAD;
+    return bubble;
+}
+
+/* Update all pipes */
+void update_pipes()
+{
+  bool_t d_load = if_id_state->op == P_LOAD;
+
+  /* Undo what squashed calls and rets did to the predictor's return
+     address stack, youngest first */
+  if (bp_active) {
+      if (id_ex_state->op == P_BUBBLE && if_id_state->op != P_STALL &&
+	  if_id_curr->status == STAT_AOK)
+	  bp_squashed(if_id_curr->icode);
+      if (ex_mem_state->op == P_BUBBLE && id_ex_state->op != P_STALL &&
+	  id_ex_curr->status == STAT_AOK)
+	  bp_squashed(id_ex_curr->icode);
   }
+
+  if (update_pipe(pc_state))
+      pipe_regs.pc[pc_state->curr] = bubble_pc;
+  if (update_pipe(if_id_state))
+      pipe_regs.if_id[if_id_state->curr] = bubble_if_id;
+  if (update_pipe(id_ex_state))
+      pipe_regs.id_ex[id_ex_state->curr] = bubble_id_ex;
+  if (update_pipe(ex_mem_state))
+      pipe_regs.ex_mem[ex_mem_state->curr] = bubble_ex_mem;
+  if (update_pipe(mem_wb_state))
+      pipe_regs.mem_wb[mem_wb_state->curr] = bubble_mem_wb;
+  connect_pipes();
+  /* Let the branch predictor see calls and rets as they enter decode */
+  if (bp_active && d_load && if_id_curr->status == STAT_AOK)
+      bp_fetched(if_id_curr->icode, if_id_curr->valp);
 }
 
 /* Set all pipes to bubble values */
 void clear_pipes()
 {
   int s;
-  for (s = 0; s < pipe_count; s++) {
-    pipe_ptr p = pipes[s];
-    memcpy(p->current, p->bubble_val, p->count);
-    memcpy(p->next, p->bubble_val, p->count);
-    p->op = P_LOAD;
+  for (s = 0; s < 2; s++) {
+    pipe_regs.pc[s] = bubble_pc;
+    pipe_regs.if_id[s] = bubble_if_id;
+    pipe_regs.id_ex[s] = bubble_id_ex;
+    pipe_regs.ex_mem[s] = bubble_ex_mem;
+    pipe_regs.mem_wb[s] = bubble_mem_wb;
   }
+  for (s = IF_STAGE; s <= WB_STAGE; s++) {
+    pipes[s].curr = 0;
+    pipes[s].op = P_LOAD;
+  }
+  connect_pipes();
+}
+
+/******************** Bubble attribution *************************/
+
+static bool_t is_exception(stat_t s)
+{
+    return s == STAT_ADR || s == STAT_INS || s == STAT_HLT;
+}
+
+/* Work out which hazard made the control logic inject a bubble into
+   pipe register s this cycle.  The HCL only yields stall and bubble
+   signals, so the cause is read back from the pipeline state in a way
+   that holds for all of the pipe-*.hcl variants */
+static hazard_tag bubble_cause(stage_id_t s)
+{
+    hazard_tag t = { H_OTHER, if_id_curr->stage_pc };
+    byte_t e_icode = id_ex_curr->icode;
+
+    if (s == WB_STAGE && mem_held) {
+	t.cause = H_DCACHE;
+	t.pc = ex_mem_curr->stage_pc;
+    } else if (s == ID_STAGE && fetch_bubble) {
+	t.cause = H_ICACHE;
+	t.pc = f_pc;
+    } else if (is_exception(mem_wb_next->status)) {
+	/* Draining the pipeline behind an exception */
+	t.cause = H_EXCEPT;
+	t.pc = ex_mem_curr->stage_pc;
+    } else if (is_exception(mem_wb_curr->status)) {
+	t.cause = H_EXCEPT;
+	t.pc = mem_wb_curr->stage_pc;
+    } else if (ex_mem_curr->icode == I_RET && ex_mem_state->op == P_BUBBLE) {
+	/* Squashing the instructions behind a mispredicted ret (VERSION=bp) */
+	t.cause = H_RET;
+	t.pc = ex_mem_curr->stage_pc;
+    } else if (e_icode == I_JMP && if_id_state->op == P_BUBBLE &&
+	       id_ex_state->op == P_BUBBLE) {
+	/* Squashing both instructions fetched after the jump in E */
+	t.cause = H_MISPRED;
+	t.pc = id_ex_curr->stage_pc;
+    } else if (s == EX_STAGE && if_id_state->op == P_STALL) {
+	/* Holding the instruction in D back until its operands are ready.
+	   The instruction in E is to blame if it is loading one of them */
+	byte_t dstm = id_ex_curr->destm;
+	if ((e_icode == I_MRMOVQ || e_icode == I_POPQ) && dstm != REG_NONE &&
+	    (dstm == id_ex_next->srca || dstm == id_ex_next->srcb)) {
+	    t.cause = H_LOADUSE;
+	    t.pc = id_ex_curr->stage_pc;
+	} else {
+	    t.cause = H_DATA;
+	}
+    } else if (s == ID_STAGE) {
+	/* Waiting for a ret to reach WB */
+	if (if_id_curr->icode == I_RET) {
+	    t.cause = H_RET;
+	} else if (e_icode == I_RET) {
+	    t.cause = H_RET;
+	    t.pc = id_ex_curr->stage_pc;
+	} else if (ex_mem_curr->icode == I_RET) {
+	    t.cause = H_RET;
+	    t.pc = ex_mem_curr->stage_pc;
+	}
+    }
+    return t;
+}
+
+/* Record the causes of the bubbles requested by do_stall_check */
+static void tag_bubbles()
+{
+    int s;
+    for (s = ID_STAGE; s <= WB_STAGE; s++)
+	if (pipes[s].op == P_BUBBLE)
+	    bubble_tags[s] = bubble_cause(s);
+}
+
+/* Move the tags along with the pipe register contents.  Must be called
+   just before update_pipes, while the pending operations are visible */
+static void shift_tags()
+{
+    static hazard_tag no_tag = { H_NONE, 0 };
+    hazard_tag err_tag = { H_OTHER, 0 };
+    int s;
+
+    for (s = WB_STAGE; s >= ID_STAGE; s--) {
+	switch (pipes[s].op) {
+	case P_LOAD:
+	    pipe_tags[s] = s > ID_STAGE ? pipe_tags[s-1] : no_tag;
+	    break;
+	case P_BUBBLE:
+	    pipe_tags[s] = bubble_tags[s];
+	    break;
+	case P_ERROR:
+	    pipe_tags[s] = err_tag;
+	    break;
+	case P_STALL:
+	default:
+	    break;
+	}
+    }
+}
+
+/* Charge a cycle in which WB holds no instruction */
+static void charge_bubble()
+{
+    hazard_tag t = pipe_tags[WB_STAGE];
+
+    if (t.cause == H_NONE) {
+	/* E.g., the second half of a split popq */
+	t.cause = H_OTHER;
+	t.pc = mem_wb_curr->stage_pc;
+    }
+    hazard_cycles[t.cause]++;
+    if (hazard_pc_cycles && t.pc >= 0 && t.pc < MEM_SIZE)
+	hazard_pc_cycles[t.pc][t.cause]++;
+}
+
+/* Print the cycles charged to each hazard as a CPI stack, and
+   optionally by instruction address */
+void report_hazards()
+{
+    word_t pc;
+    int h;
+    double n = instructions > 0 ? (double) instructions : 1.0;
+
+    printf("CPI stack:\n");
+    printf("  %-12s%8lld  %.2f\n", "instructions", instructions,
+	   instructions > 0 ? 1.0 : 0.0);
+    for (h = H_NONE+1; h < H_NCAUSE; h++)
+	printf("  %-12s%8lld  %.2f\n", hazard_names[h], hazard_cycles[h],
+	       hazard_cycles[h] / n);
+    printf("  %-12s%8lld  %.2f\n", "total", cycles, cycles / n);
+
+    if (!hazard_pc_cycles)
+	return;
+    printf("Bubble cycles by instruction:\n");
+    printf("  %-6s%-8s", "PC", "instr");
+    for (h = H_NONE+1; h < H_NCAUSE; h++)
+	printf("%11s", hazard_names[h]);
+    printf("\n");
+    for (pc = 0; pc < MEM_SIZE; pc++) {
+	word_t total = 0;
+	byte_t instr = HPACK(I_NOP, F_NONE);
+	for (h = H_NONE+1; h < H_NCAUSE; h++)
+	    total += hazard_pc_cycles[pc][h];
+	if (total == 0)
+	    continue;
+	get_byte_val(mem, pc, &instr);
+	printf("  0x%03llx %-8s", pc, iname(instr));
+	for (h = H_NONE+1; h < H_NCAUSE; h++)
+	    printf("%11lld", hazard_pc_cycles[pc][h]);
+	printf("\n");
+    }
 }
 
 /******************** Utility Code *************************/
@@ -1429,7 +1924,21 @@ void do_if_stage()
     if_id_next->valp = valp;
     if_id_next->valc = valc;
 
+    /* Look up the instruction in the I-cache.  A stalled fetch stage
+       presents the same address again, which does not count */
+    if (fetch_wait > 0)
+	fetch_wait--;
+    if (icache && !imem_error && fetch_wait == 0 && f_pc != fetch_addr) {
+	fetch_addr = f_pc;
+	fetch_wait = miss_penalty * cache_access(icache, f_pc, valp - f_pc, FALSE);
+	if (fetch_wait > 0)
+	    sim_log("\tFetch: I-cache miss at 0x%llx, %d cycle stall\n",
+		    f_pc, fetch_wait);
+    }
+    fetch_held = fetch_wait > 0;
+
     pc_next->pc = gen_f_predPC();
+    if_id_next->predpc = pc_next->pc;
 
     pc_next->status = (if_id_next->status == STAT_AOK) ? STAT_AOK : STAT_BUB;
 
@@ -1477,6 +1986,7 @@ void do_id_wb_stages()
     id_ex_next->ifun = if_id_curr->ifun;
     id_ex_next->valc = if_id_curr->valc;
     id_ex_next->stage_pc = if_id_curr->stage_pc;
+    id_ex_next->predpc = if_id_curr->predpc;
     id_ex_next->status = if_id_curr->status;
 }
 
@@ -1526,6 +2036,7 @@ void do_ex_stage()
     ex_mem_next->srca = id_ex_curr->srca;
     ex_mem_next->status = id_ex_curr->status;
     ex_mem_next->stage_pc = id_ex_curr->stage_pc;
+    ex_mem_next->predpc = id_ex_curr->predpc;
 }
 
 /* Functions defined using HCL */
@@ -1567,6 +2078,29 @@ void do_mem_stage()
     mem_wb_next->destm = ex_mem_curr->destm;
     mem_wb_next->status = gen_m_stat();
     mem_wb_next->stage_pc = ex_mem_curr->stage_pc;
+    mem_wb_next->predpc = ex_mem_curr->predpc;
+
+    /* Look up the data in the D-cache.  An instruction held here while
+       its block arrives does not look it up again */
+    if (mem_wait > 0)
+	mem_wait--;
+    else if (dcache && (read || mem_write) && !dmem_error) {
+	mem_wait = miss_penalty * cache_access(dcache, mem_addr, 8, mem_write);
+	if (mem_wait > 0)
+	    sim_log("\tMemory: D-cache miss at 0x%llx, %d cycle stall\n",
+		    mem_addr, mem_wait);
+    }
+    mem_held = mem_wait > 0;
+
+    /* Train the branch predictor.  Instructions leaving this stage are
+       known to be on the correct path */
+    if (bp_active && ex_mem_curr->status == STAT_AOK && !mem_held) {
+	if (ex_mem_curr->icode == I_JMP)
+	    bp_resolve_jump(ex_mem_curr->stage_pc, ex_mem_curr->ifun,
+			    ex_mem_curr->takebranch, ex_mem_curr->predpc);
+	else if (ex_mem_curr->icode == I_RET && !dmem_error)
+	    bp_resolve_ret(ex_mem_curr->predpc, valm);
+    }
 }
 
 /* Set stalling conditions for different stages */
@@ -1591,6 +2125,36 @@ p_stat_t pipe_cntl(char *name, word_t stall, word_t bubble)
     }
 }
 
+/* Set pipe p to op, unless the control logic has flagged an error */
+static void override_op(pipe_ptr p, p_stat_t op)
+{
+    if (p->op != P_ERROR)
+	p->op = op;
+}
+
+/* Override the control logic while a cache miss is being serviced */
+static void hold_for_caches()
+{
+    fetch_bubble = FALSE;
+    if (!fetch_held && !mem_held)
+	return;
+    /* Fetch again from the address just tried.  Loading f_pc rather
+       than stalling keeps any redirection of fetch made this cycle */
+    if (pc_state->op == P_LOAD) {
+	pc_next->pc = f_pc;
+	pc_next->status = STAT_AOK;
+    }
+    if (mem_held) {
+	override_op(if_id_state, P_STALL);
+	override_op(id_ex_state, P_STALL);
+	override_op(ex_mem_state, P_STALL);
+	override_op(mem_wb_state, P_BUBBLE);
+    } else if (if_id_state->op == P_LOAD) {
+	if_id_state->op = P_BUBBLE;
+	fetch_bubble = TRUE;
+    }
+}
+
 void do_stall_check()
 {
     pc_state->op = pipe_cntl("PC", gen_F_stall(), gen_F_bubble());
@@ -1598,6 +2162,9 @@ void do_stall_check()
     id_ex_state->op = pipe_cntl("EX", gen_E_stall(), gen_E_bubble());
     ex_mem_state->op = pipe_cntl("MEM", gen_M_stall(), gen_M_bubble());
     mem_wb_state->op = pipe_cntl("WB", gen_W_stall(), gen_W_bubble());
+    hold_for_caches();
+    if (hazard_stats)
+	tag_bubbles();
 }
 
 
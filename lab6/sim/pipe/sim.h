@@ -43,8 +43,8 @@ extern stat_t stat;
 /* Operand sources in EX (to show forwarding) */
 extern mux_source_t amux, bmux;
 
-/* Provide global access to current states of all pipeline registers */
-pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
+/* Provide global access to control of all pipeline registers */
+extern pipe_ptr pc_state, if_id_state, id_ex_state, ex_mem_state, mem_wb_state;
 
 /* Current States */
 extern pc_ptr pc_curr;
@@ -121,6 +121,9 @@ word_t sim_run_pipe(word_t max_instr, word_t max_cycle, byte_t *statusp, cc_t *c
 /* If dumpfile set nonNULL, lots of status info printed out */
 void sim_set_dumpfile(FILE *file);
 
+/* Print the cycles lost to each kind of hazard (collected under -s) */
+void report_hazards();
+
 /*
  * sim_log dumps a formatted string to the dumpfile, if it exists
  * accepts variable argument list
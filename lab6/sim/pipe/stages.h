@@ -22,6 +22,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Predicted address of the following instruction */
+    word_t predpc;
 } if_id_ele, *if_id_ptr;
 
 /* ID/EX Pipe Register */
@@ -38,6 +40,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Predicted address of the following instruction */
+    word_t predpc;
 } id_ex_ele, *id_ex_ptr;
 
 /* EX/MEM Pipe Register */
@@ -53,6 +57,8 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Predicted address of the following instruction */
+    word_t predpc;
 } ex_mem_ele, *ex_mem_ptr;
 
 /* Mem/WB Pipe Register */
@@ -66,10 +72,26 @@ typedef struct {
     stat_t status;
     /* The following is included for debugging */
     word_t stage_pc;
+    /* Predicted address of the following instruction */
+    word_t predpc;
 } mem_wb_ele, *mem_wb_ptr;
 
+/* All pipeline registers, each with a current and a next copy.
+   Kept in one cache-line aligned block so that the whole pipeline state
+   stays in a handful of lines.  Loading a register just flips which
+   copy is current (see update_pipes) rather than copying its state */
+typedef struct {
+    pc_ele pc[2];
+    if_id_ele if_id[2];
+    id_ex_ele id_ex[2];
+    ex_mem_ele ex_mem[2];
+    mem_wb_ele mem_wb[2];
+} __attribute__ ((aligned (64))) pipe_regs_t;
+
 /************ Global Declarations ********************/
 
+extern pipe_regs_t pipe_regs;
+
 extern pc_ele bubble_pc;
 extern if_id_ele bubble_if_id;
 extern id_ex_ele bubble_id_ex;
@@ -0,0 +1,127 @@
+#!/usr/bin/perl
+#!/usr/local/bin/perl
+
+#
+# sweep.pl - Time ncopy on every combination of pipeline version,
+#            branch predictor setting and array length, and write
+#            the results as CSV
+#
+# Each version is built as its own copy of nbench, which then runs all
+# the lengths for one predictor setting across its worker processes.
+# Predictor settings are only swept for versions whose HCL consults the
+# predictor (pipe-bp.hcl); the others are run once, with "-" in the
+# predictor and ras columns.
+#
+use Getopt::Std;
+
+#
+# Configuration
+#
+$versions = "full,bp";
+$models = "taken";
+$rases = "0";
+$lengths = "1-64";
+$maxblock = 64;
+$ncopy = "ncopy.ys";
+$nbenchopts = "";
+$jobopts = "";
+$make = "make";
+
+#
+# usage - Print the help message and terminate
+#
+sub usage {
+    print STDERR "Usage: $0 [-h] [-v V] [-b B] [-R R] [-n N] [-j J] [-p OPTS] [-o OUT] [-f FILE]\n";
+    print STDERR "   -h      Print help message\n";
+    print STDERR "   -v V    Comma-separated pipe-*.hcl versions (default $versions)\n";
+    print STDERR "   -b B    Comma-separated branch predictor models (default $models)\n";
+    print STDERR "   -R R    Comma-separated return address stack sizes (default $rases)\n";
+    print STDERR "   -n N    Array lengths, e.g. 1-8,16,32 (default $lengths)\n";
+    print STDERR "   -j J    Worker processes per run (default one per CPU)\n";
+    print STDERR "   -p OPTS Pass options OPTS to every run (e.g., '-D 256:2:32')\n";
+    print STDERR "   -o OUT  Write the CSV to OUT (default stdout)\n";
+    print STDERR "   -f FILE Input .ys file is FILE (default $ncopy)\n";
+    die "\n";
+}
+
+getopts('hv:b:R:n:j:p:o:f:');
+
+if ($opt_h) {
+    usage();
+}
+
+$versions = $opt_v if ($opt_v);
+$models = $opt_b if ($opt_b);
+$rases = $opt_R if (defined($opt_R));
+$lengths = $opt_n if ($opt_n);
+$ncopy = $opt_f if ($opt_f);
+$nbenchopts = $opt_p if ($opt_p);
+$jobopts = "-j $opt_j" if ($opt_j);
+
+# Expand the list of lengths
+%want = ();
+$maxlen = 0;
+foreach $range (split(/,/, $lengths)) {
+    if ($range =~ /^(\d+)(-(\d+))?$/) {
+	$lo = $1;
+	$hi = defined($3) ? $3 : $1;
+    } else {
+	print STDERR "Invalid length range '$range'\n";
+	usage();
+    }
+    if ($hi < $lo || $hi > $maxblock) {
+	print STDERR "Lengths must be between 0 and $maxblock\n";
+	die "\n";
+    }
+    for ($i = $lo; $i <= $hi; $i++) {
+	$want{$i} = 1;
+    }
+    $maxlen = $hi if ($hi > $maxlen);
+}
+
+if ($opt_o) {
+    open(OUT, ">$opt_o") || die "Couldn't open $opt_o\n";
+} else {
+    open(OUT, ">&STDOUT") || die "Couldn't dup stdout\n";
+}
+print OUT "version,predictor,ras,options,length,cycles,instructions,cpi,cpe,status\n";
+
+foreach $version (split(/,/, $versions)) {
+    $hcl = "pipe-$version.hcl";
+    (-e $hcl) || die "No such version: $hcl\n";
+    $bin = "./nbench-$version.$$";
+    !(system "$make -s -B nbench VERSION=$version >/dev/null 2>&1") ||
+	die "Couldn't build nbench for $hcl\n";
+    !(system "mv nbench $bin") ||
+	die "Couldn't rename nbench to $bin\n";
+
+    # Only sweep the predictor for versions that use it
+    @settings = ();
+    if (`grep -c bp_predict $hcl` > 0) {
+	foreach $model (split(/,/, $models)) {
+	    foreach $ras (split(/,/, $rases)) {
+		push(@settings, [$model, $ras, "-B $model -R $ras"]);
+	    }
+	}
+    } else {
+	push(@settings, ["-", "-", ""]);
+    }
+
+    foreach $setting (@settings) {
+	($model, $ras, $bpopts) = @$setting;
+	@lines = `$bin -c -n $maxlen $jobopts $bpopts $nbenchopts -f $ncopy`;
+	if ($? != 0) {
+	    unlink($bin);
+	    die "Couldn't run $bin on $ncopy\n";
+	}
+	foreach $line (@lines) {
+	    chomp $line;
+	    ($len) = split(/,/, $line);
+	    if ($want{$len}) {
+		print OUT "$version,$model,$ras,\"$nbenchopts\",$line\n";
+	    }
+	}
+    }
+    unlink($bin);
+}
+close(OUT);
@@ -0,0 +1,173 @@
+/*
+ * trace.c - Instruction stream of the ISA simulator, for timing models
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "isa.h"
+#include "bpred.h"
+#include "trace.h"
+
+/* Most trainings that can wait at once.  Beyond that, the earliest is
+   done early */
+#define MAXPENDING 2048
+
+typedef struct {
+    word_t cycle;
+    byte_t icode, ifun;
+    bool_t taken;
+    word_t pc, predpc, target;
+} resolve_t;
+
+/* Waiting trainings, in order of cycle */
+static resolve_t pending[MAXPENDING];
+static int pending_head = 0, pending_cnt = 0;
+
+/* Length in bytes of an instruction, giving its fall-through address */
+static int instr_len(byte_t icode)
+{
+    switch (icode) {
+    case I_RRMOVQ: case I_ALU: case I_PUSHQ: case I_POPQ:
+	return 2;
+    case I_IRMOVQ: case I_RMMOVQ: case I_MRMOVQ: case I_IADDQ:
+	return 10;
+    case I_JMP: case I_CALL:
+	return 9;
+    default:
+	return 1;
+    }
+}
+
+stat_t trace_step(state_ptr s, trace_ptr t)
+{
+    byte_t byte0 = 0, byte1 = 0;
+    reg_id_t ra = REG_NONE, rb = REG_NONE;
+    word_t disp = 0;
+    word_t rsp = get_reg_val(s->r, REG_RSP);
+    cc_t cc0 = s->cc;
+
+    get_byte_val(s->m, s->pc, &byte0);
+    t->pc = s->pc;
+    t->icode = HI4(byte0);
+    t->ifun = LO4(byte0);
+    t->valp = t->pc + instr_len(t->icode);
+    if (get_byte_val(s->m, t->pc+1, &byte1)) {
+	ra = HI4(byte1);
+	rb = LO4(byte1);
+    }
+    t->valc = 0;
+    if (t->icode == I_JMP || t->icode == I_CALL)
+	get_word_val(s->m, t->pc+1, &t->valc);
+    else if (t->icode == I_RMMOVQ || t->icode == I_MRMOVQ)
+	get_word_val(s->m, t->pc+2, &disp);
+
+    t->srca = t->srcb = t->dste = t->dstm = REG_NONE;
+    t->readcc = t->setcc = FALSE;
+    t->mem_read = t->mem_write = FALSE;
+    t->addr = 0;
+    switch (t->icode) {
+    case I_RRMOVQ:
+	t->srca = ra;
+	if (t->ifun == C_YES || cond_holds(cc0, t->ifun))
+	    t->dste = rb;
+	t->readcc = t->ifun != C_YES;
+	break;
+    case I_IRMOVQ:
+	t->dste = rb;
+	break;
+    case I_RMMOVQ:
+	t->srca = ra;
+	t->srcb = rb;
+	t->mem_write = TRUE;
+	break;
+    case I_MRMOVQ:
+	t->srcb = rb;
+	t->dstm = ra;
+	t->mem_read = TRUE;
+	break;
+    case I_ALU:
+	t->srca = ra;
+	t->srcb = rb;
+	t->dste = rb;
+	t->setcc = TRUE;
+	break;
+    case I_IADDQ:
+	t->srcb = rb;
+	t->dste = rb;
+	t->setcc = TRUE;
+	break;
+    case I_JMP:
+	t->readcc = t->ifun != C_YES;
+	break;
+    case I_CALL:
+	t->srcb = t->dste = REG_RSP;
+	t->mem_write = TRUE;
+	t->addr = rsp - 8;
+	break;
+    case I_RET:
+	t->srca = t->srcb = t->dste = REG_RSP;
+	t->mem_read = TRUE;
+	t->addr = rsp;
+	break;
+    case I_PUSHQ:
+	t->srca = ra;
+	t->srcb = t->dste = REG_RSP;
+	t->mem_write = TRUE;
+	t->addr = rsp - 8;
+	break;
+    case I_POPQ:
+	t->srca = t->srcb = t->dste = REG_RSP;
+	t->dstm = ra;
+	t->mem_read = TRUE;
+	t->addr = rsp;
+	break;
+    default:
+	break;
+    }
+    if (t->icode == I_RMMOVQ || t->icode == I_MRMOVQ)
+	t->addr = (rb < REG_NONE ? get_reg_val(s->r, rb) : 0) + disp;
+
+    t->status = step_state(s, NULL);
+    t->next_pc = s->pc;
+    return t->status;
+}
+
+void trace_resolve_before(word_t cycle)
+{
+    while (pending_cnt > 0 && pending[pending_head].cycle < cycle) {
+	resolve_t *r = &pending[pending_head];
+	if (r->icode == I_JMP)
+	    bp_resolve_jump(r->pc, r->ifun, r->taken, r->predpc);
+	else
+	    bp_resolve_ret(r->predpc, r->target);
+	pending_head = (pending_head + 1) % MAXPENDING;
+	pending_cnt--;
+    }
+}
+
+void trace_resolve_at(trace_ptr t, word_t predpc, word_t cycle)
+{
+    int i;
+
+    if (pending_cnt == MAXPENDING)
+	trace_resolve_before(pending[pending_head].cycle + 1);
+    /* Insertion sort from the back, where it usually belongs */
+    for (i = pending_cnt; i > 0; i--) {
+	resolve_t *prev = &pending[(pending_head + i - 1) % MAXPENDING];
+	if (prev->cycle <= cycle)
+	    break;
+	pending[(pending_head + i) % MAXPENDING] = *prev;
+    }
+    {
+	resolve_t *r = &pending[(pending_head + i) % MAXPENDING];
+	r->cycle = cycle;
+	r->icode = t->icode;
+	r->ifun = t->ifun;
+	r->taken = t->next_pc != t->valp || t->ifun == C_YES;
+	r->pc = t->pc;
+	r->predpc = predpc;
+	r->target = t->next_pc;
+    }
+    pending_cnt++;
+}
@@ -0,0 +1,40 @@
+/*
+ * trace.h - Instruction stream of the ISA simulator, for timing models
+ *
+ * The timing models (wsim, osim) run a program on the ISA simulator and
+ * only decide when each instruction would have executed.  trace_step
+ * executes one instruction and describes it the way PIPE's decode
+ * stage sees it: which registers it reads and writes, whether it uses
+ * the condition codes or memory, and where control goes next.
+ *
+ * The models predict jumps, calls and rets with bpred.c as they fetch
+ * them, but may only train it once a jump or ret has resolved, which
+ * can be out of program order.  The trainings wait here until then.
+ */
+
+typedef struct {
+    word_t pc;
+    byte_t icode, ifun;
+    reg_id_t srca, srcb;  /* Registers read (srcA and srcB in PIPE) */
+    reg_id_t dste, dstm;  /* Registers written from the ALU and memory */
+    bool_t readcc;        /* Conditional jump or move */
+    bool_t setcc;         /* OPq or iaddq */
+    bool_t mem_read, mem_write;
+    word_t addr;          /* Address of the memory access, if any */
+    word_t valc;          /* Target of a jump or call */
+    word_t valp;          /* Address of the following instruction */
+    word_t next_pc;       /* Address of the next instruction executed */
+    stat_t status;        /* Status after executing it */
+} trace_rec, *trace_ptr;
+
+/* Execute the instruction at s->pc and describe it in t.  As in PIPE, a
+   conditional move that does not move has dste of REG_NONE.  Returns
+   the status of the instruction */
+stat_t trace_step(state_ptr s, trace_ptr t);
+
+/* Train the branch predictor with jump or ret t, predicted to go to
+   predpc, once it is told that cycle has been reached */
+void trace_resolve_at(trace_ptr t, word_t predpc, word_t cycle);
+
+/* Train the predictor with everything resolved before cycle */
+void trace_resolve_before(word_t cycle);
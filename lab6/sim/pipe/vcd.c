@@ -0,0 +1,182 @@
+/*
+ * vcd.c - Value change dump (VCD) waveform writer
+ *
+ * Values are turned into text by hand, a digit at a time, into a large
+ * buffer that is handed to fwrite when nearly full.  A cycle in which
+ * nothing changes costs one comparison per signal and writes nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "isa.h"
+#include "vcd.h"
+
+#define VCD_BUF 65536
+/* Longest piece written at once: a time step and one vector change */
+#define VCD_PIECE 128
+
+static const char nibble_digits[16][5] = {
+    "0000", "0001", "0010", "0011", "0100", "0101", "0110", "0111",
+    "1000", "1001", "1010", "1011", "1100", "1101", "1110", "1111"
+};
+
+typedef struct {
+    char *name;
+    int width;
+    word_t mask;        /* Bits of a value that are kept */
+    char id[4];         /* Identifier code, in printable characters */
+    int idlen;
+    bool_t known;       /* Has a value been written yet? */
+    word_t val;         /* Last value written */
+} vcd_sig;
+
+struct vcd_rec {
+    FILE *fp;
+    char *scope;
+    vcd_sig *sigs;
+    int nsigs, maxsigs;
+    bool_t started;     /* Has the header been written? */
+    bool_t timed;       /* Has a time step been written? */
+    word_t now;         /* Time of the last step written */
+    int len;            /* Characters waiting in buf */
+    char buf[VCD_BUF];
+};
+
+vcd_t vcd_open(char *fname, char *scope)
+{
+    FILE *fp = fopen(fname, "w");
+    vcd_t v;
+
+    if (!fp)
+	return NULL;
+    v = (vcd_t) calloc(1, sizeof(struct vcd_rec));
+    v->fp = fp;
+    v->scope = strdup(scope);
+    return v;
+}
+
+int vcd_add(vcd_t v, char *name, int width)
+{
+    vcd_sig *s;
+    int n = v->nsigs;
+
+    if (v->nsigs == v->maxsigs) {
+	v->maxsigs = v->maxsigs ? 2 * v->maxsigs : 64;
+	v->sigs = (vcd_sig *) realloc(v->sigs, v->maxsigs * sizeof(vcd_sig));
+    }
+    s = &v->sigs[v->nsigs++];
+    s->name = strdup(name);
+    s->width = width;
+    s->mask = width >= 64 ? ~0ULL : (1ULL << width) - 1;
+    /* Identifiers are numbers in base 94, written with '!' to '~' */
+    s->idlen = 0;
+    do {
+	s->id[s->idlen++] = '!' + n % 94;
+	n /= 94;
+    } while (n > 0 && s->idlen < 4);
+    s->known = FALSE;
+    s->val = 0;
+    return v->nsigs - 1;
+}
+
+static void vcd_flush(vcd_t v)
+{
+    if (v->len > 0)
+	fwrite(v->buf, 1, v->len, v->fp);
+    v->len = 0;
+}
+
+/* Append a line of header text */
+static void vcd_line(vcd_t v, char *fmt, ...)
+{
+    va_list ap;
+    int n;
+    if (v->len > VCD_BUF - VCD_PIECE)
+	vcd_flush(v);
+    va_start(ap, fmt);
+    n = vsnprintf(v->buf + v->len, VCD_PIECE, fmt, ap);
+    va_end(ap);
+    v->len += n < VCD_PIECE ? n : VCD_PIECE - 1;
+}
+
+static void vcd_header(vcd_t v)
+{
+    int i;
+    vcd_line(v, "$version Y86-64 PIPE simulator $end\n");
+    vcd_line(v, "$timescale 1ns $end\n");
+    vcd_line(v, "$scope module %s $end\n", v->scope);
+    for (i = 0; i < v->nsigs; i++) {
+	vcd_sig *s = &v->sigs[i];
+	vcd_line(v, "$var wire %d %.*s %s $end\n", s->width,
+		 s->idlen, s->id, s->name);
+    }
+    vcd_line(v, "$upscope $end\n");
+    vcd_line(v, "$enddefinitions $end\n");
+    v->started = TRUE;
+}
+
+void vcd_change(vcd_t v, word_t t, int n, word_t val)
+{
+    vcd_sig *s = &v->sigs[n];
+    char *p;
+    int k;
+
+    val &= s->mask;
+    if (s->known && s->val == val)
+	return;
+    s->known = TRUE;
+    s->val = val;
+    if (!v->started)
+	vcd_header(v);
+    if (v->len > VCD_BUF - VCD_PIECE)
+	vcd_flush(v);
+    if (!v->timed || t != v->now) {
+	v->len += sprintf(v->buf + v->len, "#%lld\n", t);
+	v->timed = TRUE;
+	v->now = t;
+    }
+    p = v->buf + v->len;
+    if (s->width == 1)
+	*p++ = '0' + (int) val;
+    else {
+	/* Four digits at a time, leaving out leading zeros */
+	int d = (int) ((uword_t) val >> (k = (s->width - 1) & ~3)) & 0xf;
+	while (k > 0 && d == 0)
+	    d = (int) ((uword_t) val >> (k -= 4)) & 0xf;
+	*p++ = 'b';
+	if (d == 0)
+	    *p++ = '0';
+	else {
+	    int lead = d >= 8 ? 0 : d >= 4 ? 1 : d >= 2 ? 2 : 3;
+	    memcpy(p, nibble_digits[d] + lead, 4);
+	    p += 4 - lead;
+	}
+	while (k > 0) {
+	    d = (int) ((uword_t) val >> (k -= 4)) & 0xf;
+	    memcpy(p, nibble_digits[d], 4);
+	    p += 4;
+	}
+	*p++ = ' ';
+    }
+    for (k = 0; k < s->idlen; k++)
+	*p++ = s->id[k];
+    *p++ = '\n';
+    v->len = p - v->buf;
+}
+
+void vcd_close(vcd_t v)
+{
+    int i;
+    if (!v->started)
+	vcd_header(v);
+    vcd_flush(v);
+    fclose(v->fp);
+    for (i = 0; i < v->nsigs; i++)
+	free(v->sigs[i].name);
+    free(v->sigs);
+    free(v->scope);
+    free(v);
+}
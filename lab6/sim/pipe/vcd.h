@@ -0,0 +1,25 @@
+/*
+ * vcd.h - Value change dump (VCD) waveform writer
+ *
+ * A waveform file lists, for each time step, only the signals whose
+ * values changed, so a viewer such as GTKWave can show long simulation
+ * runs.  Output is collected in a buffer and written a block at a time.
+ */
+
+typedef struct vcd_rec *vcd_t;
+
+/* Create waveform file fname, with all signals in module scope.
+   Returns NULL if the file cannot be created */
+vcd_t vcd_open(char *fname, char *scope);
+
+/* Declare a signal of width bits (1 to 64).  Returns the number by
+   which vcd_change refers to it.  All signals must be declared before
+   the first change */
+int vcd_add(vcd_t v, char *name, int width);
+
+/* Record that signal n has value val at time t.  Nothing is written if
+   the value is the same as before.  Times must not decrease */
+void vcd_change(vcd_t v, word_t t, int n, word_t val);
+
+/* Write out anything still buffered and close the file */
+void vcd_close(vcd_t v);
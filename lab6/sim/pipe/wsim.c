@@ -0,0 +1,327 @@
+/*
+ * wsim.c - Timing model of a wide, in-order PIPE
+ *
+ * Asks how fast a program such as ncopy would run on a version of PIPE
+ * that fetches, decodes and issues up to w instructions per cycle.  The
+ * program is run by the ISA simulator, and each instruction is then
+ * given the earliest cycles in which it can enter decode and execute:
+ *
+ *   Fetch	Up to w instructions a cycle.  A group ends after any
+ *		instruction predicted not to fall through.  Jumps, calls
+ *		and rets are predicted by the models in bpred.c (-b, -R),
+ *		exactly as in pipe-bp.  A mispredicted jump fetches its
+ *		real successor once it reaches the memory stage, and a
+ *		mispredicted ret once it reaches write-back.
+ *   Decode	Up to w instructions, as long as the group ahead of them
+ *		is moving into execute.
+ *   Execute	Up to w instructions a cycle, in program order.  Every
+ *		result is forwarded from the execute, memory and
+ *		write-back stages of every lane, so an instruction only
+ *		waits for one issued in the same cycle, or for a load
+ *		issued in the cycle before.  The condition codes are
+ *		forwarded the same way.  At most -m of the instructions
+ *		may access memory, and at most one may be a jump, call or
+ *		ret.
+ *
+ * Nothing stalls after execute, so an instruction completes two cycles
+ * after it issues.  With -w 1 these are the hazards of pipe-bp, and
+ * wsim gives the same cycle counts as psim built from it (or, with the
+ * default predictor, from pipe-std).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "isa.h"
+#include "bpred.h"
+#include "trace.h"
+
+#define MAXWIDTH 8
+
+/* Why an instruction could not issue together with its predecessor.
+   When several reasons hold, the first one in this list is charged */
+typedef enum { W_MISPREDICT, W_RET, W_LOAD, W_DATA, W_CC, W_MEM, W_CTL,
+	       W_TAKEN, W_WIDTH, W_FETCH, W_NONE } wait_t;
+
+static char *wait_names[] = {
+    "mispredicted jump", "mispredicted ret", "load/use", "data dependence",
+    "condition codes", "memory port", "branch unit", "taken branch",
+    "issue width", "fetch"
+};
+
+/* isa.c wants to know */
+int gui_mode = FALSE;
+
+/* Parameters modified by the command line */
+int width = 2;               /* Instructions per cycle (-w) */
+int mem_ports = 1;           /* Memory accesses per cycle (-m) */
+word_t instr_limit = 10000;  /* Instruction limit (-l) */
+int verbosity = 1;           /* Verbosity level (-v) */
+
+/* Results */
+static word_t instructions = 0;
+static word_t cycles = 0;
+static word_t issue_hist[MAXWIDTH+1];  /* Cycles issuing n instructions */
+static word_t paired = 0;              /* Issued with their predecessor */
+static word_t waits[W_NONE];           /* Held back, by reason */
+
+/*
+ * run - Execute the program in s, timing each instruction as it goes.
+ * Returns the status of the last instruction
+ */
+static stat_t run(state_ptr s)
+{
+    /* Decode and execute cycles of the last MAXWIDTH instructions */
+    word_t dcyc[MAXWIDTH], ecyc[MAXWIDTH];
+    /* Earliest cycle in which each register can be used in execute */
+    word_t reg_ready[REG_NONE] = { 0 };
+    bool_t reg_loaded[REG_NONE] = { FALSE };
+    word_t cc_ready = 0, ctl_ready = 0;
+    word_t mem_ecyc[MAXWIDTH];
+    word_t mem_cnt = 0;
+    /* Earliest decode cycle of the next instruction, and why */
+    word_t next_d = 1;
+    wait_t next_why = W_FETCH;
+    word_t first_e = 0, prev_e = 0;
+    int group = 0;
+    stat_t status = STAT_AOK;
+    word_t n;
+
+    for (n = 0; n < instr_limit && status == STAT_AOK; n++) {
+	trace_rec t;
+	bool_t mem, ctl;
+	word_t predpc;
+	word_t bound[W_NONE];
+	word_t d, e;
+	wait_t why;
+	int k;
+
+	status = trace_step(s, &t);
+	mem = t.mem_read || t.mem_write;
+	ctl = t.icode == I_JMP || t.icode == I_CALL || t.icode == I_RET;
+
+	/* Decode: after the redirect or fetch group break, once there is
+	   room for it */
+	d = next_d;
+	why = next_why;
+	if (n >= width) {
+	    word_t room = dcyc[(n-width) % MAXWIDTH] + 1;
+	    if (ecyc[(n-width) % MAXWIDTH] > room)
+		room = ecyc[(n-width) % MAXWIDTH];
+	    if (room > d) {
+		d = room;
+		why = W_FETCH;
+	    }
+	}
+
+	/* The prediction is made in the cycle before decode, and the
+	   return address stack changes as the instruction enters it */
+	trace_resolve_before(d-1);
+	predpc = bp_predict(t.pc, t.icode, t.ifun, t.valc, t.valp);
+	if (status == STAT_AOK)
+	    bp_fetched(t.icode, t.valp);
+
+	/* Execute */
+	for (k = 0; k < W_NONE; k++)
+	    bound[k] = 0;
+	bound[why] = d + 1;
+	if (n >= width)
+	    bound[W_WIDTH] = ecyc[(n-width) % MAXWIDTH] + 1;
+	for (k = 0; k < 2; k++) {
+	    reg_id_t r = k == 0 ? t.srca : t.srcb;
+	    if (r < REG_NONE) {
+		wait_t w = reg_loaded[r] ? W_LOAD : W_DATA;
+		if (reg_ready[r] > bound[w])
+		    bound[w] = reg_ready[r];
+	    }
+	}
+	if (t.readcc)
+	    bound[W_CC] = cc_ready;
+	if (mem && mem_cnt >= mem_ports)
+	    bound[W_MEM] = mem_ecyc[mem_cnt % mem_ports] + 1;
+	if (ctl)
+	    bound[W_CTL] = ctl_ready;
+	e = prev_e;
+	why = W_NONE;
+	for (k = 0; k < W_NONE; k++)
+	    if (bound[k] > e) {
+		e = bound[k];
+		why = k;
+	    }
+
+	if (verbosity >= 2)
+	    printf("0x%03llx: %-7s D %5lld  E %5lld  %s\n", t.pc,
+		   iname(HPACK(t.icode, t.ifun)), d, e,
+		   n == 0 ? "" : why == W_NONE ? "paired" : wait_names[why]);
+
+	/* Statistics */
+	if (n == 0) {
+	    first_e = e;
+	    group = 1;
+	} else if (e == prev_e) {
+	    paired++;
+	    group++;
+	} else {
+	    waits[why]++;
+	    issue_hist[group]++;
+	    issue_hist[0] += e - prev_e - 1;
+	    group = 1;
+	}
+
+	/* Record what later instructions wait for */
+	dcyc[n % MAXWIDTH] = d;
+	ecyc[n % MAXWIDTH] = e;
+	prev_e = e;
+	if (t.dste < REG_NONE) {
+	    reg_ready[t.dste] = e + 1;
+	    reg_loaded[t.dste] = FALSE;
+	}
+	if (t.dstm < REG_NONE) {
+	    reg_ready[t.dstm] = e + 2;
+	    reg_loaded[t.dstm] = TRUE;
+	}
+	if (t.setcc)
+	    cc_ready = e + 1;
+	if (mem)
+	    mem_ecyc[mem_cnt++ % mem_ports] = e;
+	if (ctl)
+	    ctl_ready = e + 1;
+
+	/* Where the next instruction is fetched from, and when */
+	next_d = d;
+	next_why = W_FETCH;
+	if (status == STAT_AOK && (t.icode == I_JMP || t.icode == I_RET))
+	    trace_resolve_at(&t, predpc, e + 1);
+	if (status == STAT_AOK && predpc != t.next_pc) {
+	    if (t.icode == I_RET) {
+		next_d = e + 3;
+		next_why = W_RET;
+	    } else {
+		next_d = e + 2;
+		next_why = W_MISPREDICT;
+	    }
+	} else if (predpc != t.valp) {
+	    next_d = d + 1;
+	    next_why = W_TAKEN;
+	}
+    }
+    trace_resolve_before(prev_e + 2);
+
+    instructions = n;
+    if (n > 0) {
+	cycles = prev_e - first_e + 1;
+	issue_hist[group]++;
+    }
+    return status;
+}
+
+static void report(stat_t status)
+{
+    int k;
+
+    if (verbosity >= 1)
+	printf("%d-wide issue, %d memory port%s: %lld instructions, status %s\n",
+	       width, mem_ports, mem_ports == 1 ? "" : "s",
+	       instructions, stat_name(status));
+    printf("CPI: %lld cycles/%lld instructions = %.2f\n", cycles, instructions,
+	   instructions > 0 ? (double) cycles / instructions : 1.0);
+    if (verbosity < 1)
+	return;
+    printf("Instructions issued per cycle:\n");
+    for (k = width; k >= 0; k--)
+	printf("  %d: %8lld cycles (%5.1f%%)\n", k, issue_hist[k],
+	       cycles > 0 ? 100.0 * issue_hist[k] / cycles : 0.0);
+    printf("Issued with the instruction before: %lld\n", paired);
+    printf("Held back by:\n");
+    for (k = 0; k < W_NONE; k++)
+	if (waits[k] > 0)
+	    printf("  %-18s %8lld\n", wait_names[k], waits[k]);
+    bp_report(stdout);
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-h] [-w n] [-m n] [-l m] [-v n] [-b model] [-R n] file.yo\n",
+	   name);
+    printf("   -h     Print this message\n");
+    printf("   -w n   Fetch, decode and issue up to 1 <= n <= %d instructions per cycle (default %d)\n",
+	   MAXWIDTH, width);
+    printf("   -m n   Allow up to n memory accesses per cycle (default %d)\n",
+	   mem_ports);
+    printf("   -l m   Set instruction limit to m (default %lld)\n", instr_limit);
+    printf("   -v n   Set verbosity level to 0 <= n <= 2 (default %d)\n",
+	   verbosity);
+    printf("   -b m   Set branch predictor to m: taken, nt, btfnt, 2bit[:n] or gshare[:n]\n");
+    printf("   -R n   Give branch predictor an n-entry return address stack\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *object_file;
+    state_ptr s;
+    stat_t status;
+    int c;
+
+    while ((c = getopt(argc, argv, "hw:m:l:v:b:R:")) != -1) {
+	switch(c) {
+	case 'w':
+	    width = atoi(optarg);
+	    if (width < 1 || width > MAXWIDTH) {
+		printf("Invalid width %d\n", width);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'm':
+	    mem_ports = atoi(optarg);
+	    if (mem_ports < 1 || mem_ports > MAXWIDTH) {
+		printf("Invalid number of memory ports %d\n", mem_ports);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'v':
+	    verbosity = atoi(optarg);
+	    if (verbosity < 0 || verbosity > 2) {
+		printf("Invalid verbosity %d\n", verbosity);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'b':
+	    if (!bp_set_model(optarg)) {
+		printf("Invalid branch predictor '%s'\n", optarg);
+		usage(argv[0]);
+	    }
+	    break;
+	case 'R':
+	    bp_set_ras(atoi(optarg));
+	    break;
+	case 'h':
+	default:
+	    usage(argv[0]);
+	    break;
+	}
+    }
+    if (optind != argc - 1)
+	usage(argv[0]);
+    object_file = fopen(argv[optind], "r");
+    if (!object_file) {
+	fprintf(stderr, "Couldn't open object file %s\n", argv[optind]);
+	exit(1);
+    }
+
+    s = new_state(MEM_SIZE);
+    if (!load_mem(s->m, object_file, 1)) {
+	fprintf(stderr, "No lines of code found\n");
+	exit(1);
+    }
+    fclose(object_file);
+
+    status = run(s);
+    report(status);
+    free_state(s);
+    return 0;
+}
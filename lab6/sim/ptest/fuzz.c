@@ -0,0 +1,810 @@
+/**************************************************************************
+ * fuzz.c - Differential testing of SEQ and PIPE on random programs
+ *
+ * Generates random Y86-64 programs and runs each one on the ISA
+ * simulator (yis), SEQ (ssim) and PIPE (psim), all inside this process,
+ * comparing the final registers, memory, condition codes, status and
+ * instruction count.  Where the perl tests try fixed templates, one
+ * simulator run per system() call, fuzz tries many thousands of
+ * programs mixing ALU operations, moves, conditional moves, loads,
+ * stores, pushes, pops, forward branches, bounded loops and calls.
+ *
+ * Programs are built from pieces that can each be taken out, or
+ * replaced by the code inside them, without making the program invalid.
+ * When the simulators disagree on a program, fuzz removes every piece
+ * it can while they still disagree, and leaves the reduced program in
+ * fuzz-SEED.ys, where SEED regenerates the original with -s SEED -n 1.
+ *
+ * The simulators keep their state in globals, so programs are spread
+ * over forked worker processes, as in nbench.
+ **************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "isa.h"
+
+/* The simulators, from simrun.c */
+stat_t seq_run(mem_t image, word_t max_instr, state_ptr result,
+	       word_t *icountp);
+stat_t pipe_run(mem_t image, word_t max_instr, state_ptr result,
+		word_t *icountp);
+
+/* isa.c wants to know */
+int gui_mode = FALSE;
+
+#define MAXFUNC 3       /* Functions, including the main program */
+#define MAXDEPTH 3      /* Nesting of branches, loops and saves */
+#define MAXLOOPS 2      /* Nesting of loops within a function */
+#define MAXLOOPCNT 3    /* Iterations of a loop */
+#define DATAWORDS 16    /* Size of the data area */
+#define STACKBYTES 256  /* Size of the stack */
+#define MAXLINES 4096   /* Instructions and labels in a program */
+#define WHY_LEN 128     /* Every difference of both simulators: 2 * 58 + 1 */
+
+/* Registers with a fixed use.  The others are written at random */
+#define REG_DATA REG_R14                   /* Address of the data area */
+static reg_id_t loop_regs[MAXLOOPS] = { REG_R13, REG_R12 };
+
+/* Parameters modified by the command line */
+static int nprogs = 1000;           /* Programs to run (-n) */
+static unsigned seed = 1;           /* Seed of the first program (-s) */
+static int njobs = 0;               /* Worker processes (-j), 0 = #cpus */
+static word_t instr_limit = 100000; /* Instruction limit per run (-l) */
+static int npieces = 30;            /* Pieces in the main program (-m) */
+static bool_t use_iaddq = FALSE;    /* Generate iaddq? (-i) */
+static bool_t reduce = TRUE;        /* Reduce failing programs? (-x) */
+static int verbose = 1;             /* Report each failure? (-q) */
+
+/*
+ * A program is a list of pieces for each function.  An instruction
+ * piece is a single instruction.  The others hold a list of pieces:
+ *   K_IF    jXX L; body; L:                  (a forward branch)
+ *   K_LOOP  irmovq $n,rC; L: body; decrement rC; jg L
+ *   K_SAVE  pushq rA; body; popq rB
+ *   K_CALL  call F
+ */
+typedef enum { K_INSTR, K_IF, K_LOOP, K_SAVE, K_CALL } kind_t;
+
+typedef struct piece {
+    kind_t kind;
+    byte_t icode, ifun;   /* Instruction, or jump of K_IF */
+    byte_t ra, rb;        /* Registers; for K_LOOP, the counter and a
+			     scratch register */
+    word_t valc;          /* Constant; for K_LOOP, the iteration count */
+    int func;             /* Function called by K_CALL */
+    struct piece *body;
+    struct piece *next;
+} piece_t;
+
+typedef struct {
+    int nfuncs;
+    piece_t *funcs[MAXFUNC];   /* funcs[0] is the main program */
+    word_t data[DATAWORDS];
+} prog_t;
+
+/* Outcome of a run */
+typedef enum { OUT_OK, OUT_FAIL, OUT_LIMIT } outcome_t;
+
+typedef struct {
+    int prog;           /* Index of program */
+    outcome_t outcome;
+    word_t instrs;      /* Instructions executed by yis */
+    int lines;          /* Instructions in reduced failing program */
+    char why[WHY_LEN];  /* What differed */
+} result_t;
+
+/**********************************************************************
+ * Random program generation
+ **********************************************************************/
+
+static unsigned long long rng_state;
+
+static unsigned rnd(unsigned n)
+{
+    rng_state = rng_state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned) (rng_state >> 33) % n;
+}
+
+/* A value that is sometimes small, sometimes anything */
+static word_t rnd_value()
+{
+    switch (rnd(4)) {
+    case 0:
+	return (word_t) rnd(17) - 8;
+    case 1:
+	return (word_t) rnd(256);
+    default:
+	return ((word_t) rnd(1u << 31) << 33) ^ ((word_t) rnd(1u << 31) << 2) ^
+	    rnd(4);
+    }
+}
+
+/* A register an instruction may write */
+static byte_t rnd_dest()
+{
+    byte_t r;
+    do
+	r = rnd(REG_R12);
+    while (r == REG_RSP);
+    return r;
+}
+
+/* A register an instruction may read */
+static byte_t rnd_src()
+{
+    return rnd(REG_NONE);
+}
+
+static piece_t *new_piece(kind_t kind)
+{
+    piece_t *p = (piece_t *) calloc(1, sizeof(piece_t));
+    p->kind = kind;
+    p->ra = p->rb = REG_NONE;
+    return p;
+}
+
+static void free_pieces(piece_t *p)
+{
+    while (p) {
+	piece_t *next = p->next;
+	free_pieces(p->body);
+	free(p);
+	p = next;
+    }
+}
+
+static piece_t *gen_instr()
+{
+    piece_t *p = new_piece(K_INSTR);
+    switch (rnd(use_iaddq ? 9 : 8)) {
+    case 0:
+	p->icode = I_IRMOVQ;
+	p->rb = rnd_dest();
+	p->valc = rnd_value();
+	break;
+    case 1:
+	p->icode = I_RRMOVQ;
+	p->ifun = rnd(C_G + 1);
+	p->ra = rnd_src();
+	p->rb = rnd_dest();
+	break;
+    case 2:
+    case 3:
+	p->icode = I_ALU;
+	p->ifun = rnd(A_NONE);
+	p->ra = rnd_src();
+	p->rb = rnd_dest();
+	break;
+    case 4:
+	p->icode = I_RMMOVQ;
+	p->ra = rnd_src();
+	p->rb = REG_DATA;
+	p->valc = rnd(8 * DATAWORDS - 7);
+	break;
+    case 5:
+    case 6:
+	p->icode = I_MRMOVQ;
+	p->ra = rnd_dest();
+	p->rb = REG_DATA;
+	p->valc = rnd(8 * DATAWORDS - 7);
+	break;
+    case 7:
+	p->icode = I_NOP;
+	break;
+    default:
+	p->icode = I_IADDQ;
+	p->rb = rnd_dest();
+	p->valc = rnd_value();
+	break;
+    }
+    return p;
+}
+
+/* Generate n pieces for function fn, nested depth deep within it, with
+   loops loops around them */
+static piece_t *gen_pieces(prog_t *prog, int fn, int n, int depth, int loops)
+{
+    piece_t *head = NULL, **tail = &head;
+    int i;
+
+    for (i = 0; i < n; i++) {
+	piece_t *p;
+	unsigned k = rnd(20);
+	if (depth < MAXDEPTH && k == 0) {
+	    p = new_piece(K_IF);
+	    p->icode = I_JMP;
+	    p->ifun = rnd(C_G + 1);
+	    p->body = gen_pieces(prog, fn, 1 + rnd(4), depth + 1, loops);
+	} else if (depth < MAXDEPTH && loops < MAXLOOPS && k == 1) {
+	    p = new_piece(K_LOOP);
+	    p->ra = loop_regs[loops];
+	    p->rb = rnd_dest();
+	    p->valc = 1 + rnd(MAXLOOPCNT);
+	    p->body = gen_pieces(prog, fn, 1 + rnd(5), depth + 1, loops + 1);
+	} else if (depth < MAXDEPTH && k == 2) {
+	    p = new_piece(K_SAVE);
+	    p->ra = rnd_src();
+	    p->rb = rnd_dest();
+	    p->body = gen_pieces(prog, fn, rnd(4), depth + 1, loops);
+	} else if (fn + 1 < prog->nfuncs && k == 3) {
+	    /* Only later functions are called, so there is no recursion */
+	    p = new_piece(K_CALL);
+	    p->func = fn + 1 + rnd(prog->nfuncs - fn - 1);
+	} else
+	    p = gen_instr();
+	*tail = p;
+	tail = &p->next;
+    }
+    return head;
+}
+
+static void gen_prog(prog_t *prog, unsigned s)
+{
+    piece_t *init = NULL, **tail = &init;
+    int i;
+    reg_id_t r;
+
+    rng_state = s;
+    prog->nfuncs = 1 + rnd(MAXFUNC);
+    for (i = prog->nfuncs - 1; i >= 0; i--)
+	prog->funcs[i] = gen_pieces(prog, i, i == 0 ? npieces : 3 + rnd(8),
+				    0, 0);
+    /* Start the main program with every register given a value */
+    for (r = REG_RAX; r < REG_R12; r++) {
+	piece_t *p;
+	if (r == REG_RSP)
+	    continue;
+	p = new_piece(K_INSTR);
+	p->icode = I_IRMOVQ;
+	p->rb = r;
+	p->valc = rnd_value();
+	*tail = p;
+	tail = &p->next;
+    }
+    *tail = prog->funcs[0];
+    prog->funcs[0] = init;
+    for (i = 0; i < DATAWORDS; i++)
+	prog->data[i] = rnd_value();
+}
+
+static void free_prog(prog_t *prog)
+{
+    int i;
+    for (i = 0; i < prog->nfuncs; i++)
+	free_pieces(prog->funcs[i]);
+}
+
+/**********************************************************************
+ * Layout, encoding and printing
+ **********************************************************************/
+
+/* A program laid out as a list of instructions and labels */
+typedef struct {
+    byte_t icode, ifun, ra, rb;
+    word_t valc;
+    int label;          /* Label defined here (icode is then -1),
+			   or label used by a jump or call, or -1 */
+} line_t;
+
+typedef struct {
+    int nlines;
+    line_t lines[MAXLINES];
+    int nlabels;
+    word_t label_addr[MAXLINES];
+    int func_label[MAXFUNC];
+    word_t data_addr, stack_addr;
+} layout_t;
+
+/* Labels with fixed numbers */
+#define LBL_DATA 0
+#define LBL_STACK 1
+
+static void add_line(layout_t *l, byte_t icode, byte_t ifun, byte_t ra,
+		     byte_t rb, word_t valc, int label)
+{
+    line_t *ln;
+    if (l->nlines >= MAXLINES) {
+	fprintf(stderr, "Program too long\n");
+	exit(1);
+    }
+    ln = &l->lines[l->nlines++];
+    ln->icode = icode;
+    ln->ifun = ifun;
+    ln->ra = ra;
+    ln->rb = rb;
+    ln->valc = valc;
+    ln->label = label;
+}
+
+#define LABEL_LINE 0xFF
+
+static void add_label(layout_t *l, int label)
+{
+    add_line(l, LABEL_LINE, 0, REG_NONE, REG_NONE, 0, label);
+}
+
+static void flatten(layout_t *l, piece_t *p, bool_t *called)
+{
+    int lbl;
+    for (; p; p = p->next) {
+	switch (p->kind) {
+	case K_INSTR:
+	    add_line(l, p->icode, p->ifun, p->ra, p->rb, p->valc, -1);
+	    break;
+	case K_IF:
+	    lbl = l->nlabels++;
+	    add_line(l, I_JMP, p->ifun, REG_NONE, REG_NONE, 0, lbl);
+	    flatten(l, p->body, called);
+	    add_label(l, lbl);
+	    break;
+	case K_LOOP:
+	    lbl = l->nlabels++;
+	    add_line(l, I_IRMOVQ, 0, REG_NONE, p->ra, p->valc, -1);
+	    add_label(l, lbl);
+	    flatten(l, p->body, called);
+	    if (use_iaddq)
+		add_line(l, I_IADDQ, 0, REG_NONE, p->ra, -1, -1);
+	    else {
+		add_line(l, I_IRMOVQ, 0, REG_NONE, p->rb, 1, -1);
+		add_line(l, I_ALU, A_SUB, p->rb, p->ra, 0, -1);
+	    }
+	    add_line(l, I_JMP, C_G, REG_NONE, REG_NONE, 0, lbl);
+	    break;
+	case K_SAVE:
+	    add_line(l, I_PUSHQ, 0, p->ra, REG_NONE, 0, -1);
+	    flatten(l, p->body, called);
+	    add_line(l, I_POPQ, 0, p->rb, REG_NONE, 0, -1);
+	    break;
+	case K_CALL:
+	    called[p->func] = TRUE;
+	    add_line(l, I_CALL, 0, REG_NONE, REG_NONE, 0,
+		     l->func_label[p->func]);
+	    break;
+	}
+    }
+}
+
+static int instr_len(byte_t icode)
+{
+    switch (icode) {
+    case LABEL_LINE:
+	return 0;
+    case I_HALT: case I_NOP: case I_RET:
+	return 1;
+    case I_RRMOVQ: case I_ALU: case I_PUSHQ: case I_POPQ:
+	return 2;
+    case I_JMP: case I_CALL:
+	return 9;
+    default:
+	return 10;
+    }
+}
+
+static void layout(prog_t *prog, layout_t *l)
+{
+    bool_t called[MAXFUNC] = { FALSE };
+    word_t addr = 0;
+    int i;
+
+    l->nlines = 0;
+    l->nlabels = 2;
+    for (i = 0; i < prog->nfuncs; i++)
+	l->func_label[i] = l->nlabels++;
+    add_line(l, I_IRMOVQ, 0, REG_NONE, REG_RSP, 0, LBL_STACK);
+    add_line(l, I_IRMOVQ, 0, REG_NONE, REG_DATA, 0, LBL_DATA);
+    flatten(l, prog->funcs[0], called);
+    add_line(l, I_HALT, 0, REG_NONE, REG_NONE, 0, -1);
+    /* Functions only call later ones, so one pass finds all callees */
+    for (i = 1; i < prog->nfuncs; i++)
+	if (called[i]) {
+	    add_label(l, l->func_label[i]);
+	    flatten(l, prog->funcs[i], called);
+	    add_line(l, I_RET, 0, REG_NONE, REG_NONE, 0, -1);
+	}
+
+    for (i = 0; i < l->nlines; i++) {
+	if (l->lines[i].icode == LABEL_LINE)
+	    l->label_addr[l->lines[i].label] = addr;
+	addr += instr_len(l->lines[i].icode);
+    }
+    l->data_addr = l->label_addr[LBL_DATA] = (addr + 7) & ~7;
+    l->stack_addr = l->label_addr[LBL_STACK] =
+	l->data_addr + 8 * DATAWORDS + STACKBYTES;
+    if (l->stack_addr > MEM_SIZE) {
+	fprintf(stderr, "Program too long\n");
+	exit(1);
+    }
+}
+
+/* Value of the constant word in line ln */
+static word_t line_valc(layout_t *l, line_t *ln)
+{
+    return ln->label >= 0 ? l->label_addr[ln->label] : ln->valc;
+}
+
+static mem_t encode(prog_t *prog, layout_t *l)
+{
+    mem_t m = init_mem(MEM_SIZE);
+    word_t addr = 0;
+    int i;
+
+    for (i = 0; i < l->nlines; i++) {
+	line_t *ln = &l->lines[i];
+	int len = instr_len(ln->icode);
+	if (len == 0)
+	    continue;
+	set_byte_val(m, addr, HPACK(ln->icode, ln->ifun));
+	if (len == 2 || len == 10)
+	    set_byte_val(m, addr + 1, HPACK(ln->ra, ln->rb));
+	if (len == 9)
+	    set_word_val(m, addr + 1, line_valc(l, ln));
+	if (len == 10)
+	    set_word_val(m, addr + 2, line_valc(l, ln));
+	addr += len;
+    }
+    for (i = 0; i < DATAWORDS; i++)
+	set_word_val(m, l->data_addr + 8 * i, prog->data[i]);
+    return m;
+}
+
+static void print_label(FILE *fp, layout_t *l, int label)
+{
+    int i;
+    if (label == LBL_DATA)
+	fprintf(fp, "data");
+    else if (label == LBL_STACK)
+	fprintf(fp, "stack");
+    else {
+	for (i = 1; i < MAXFUNC && l->func_label[i] != label; i++)
+	    ;
+	if (i < MAXFUNC)
+	    fprintf(fp, "F%d", i);
+	else
+	    fprintf(fp, "L%d", label);
+    }
+}
+
+/* Print the program as assembly code that yas accepts */
+static void print_prog(FILE *fp, prog_t *prog, layout_t *l)
+{
+    int i;
+
+    fprintf(fp, "\t.pos 0\n");
+    for (i = 0; i < l->nlines; i++) {
+	line_t *ln = &l->lines[i];
+	if (ln->icode == LABEL_LINE) {
+	    print_label(fp, l, ln->label);
+	    fprintf(fp, ":\n");
+	    continue;
+	}
+	fprintf(fp, "\t%s", iname(HPACK(ln->icode, ln->ifun)));
+	if (instr_len(ln->icode) > 1)
+	    fprintf(fp, " ");
+	switch (ln->icode) {
+	case I_IRMOVQ:
+	case I_IADDQ:
+	    if (ln->label >= 0)
+		print_label(fp, l, ln->label);
+	    else
+		fprintf(fp, "$%lld", ln->valc);
+	    fprintf(fp, ",%s", reg_name(ln->rb));
+	    break;
+	case I_RRMOVQ:
+	case I_ALU:
+	    fprintf(fp, "%s,%s", reg_name(ln->ra), reg_name(ln->rb));
+	    break;
+	case I_RMMOVQ:
+	    fprintf(fp, "%s,%lld(%s)", reg_name(ln->ra), ln->valc,
+		    reg_name(ln->rb));
+	    break;
+	case I_MRMOVQ:
+	    fprintf(fp, "%lld(%s),%s", ln->valc, reg_name(ln->rb),
+		    reg_name(ln->ra));
+	    break;
+	case I_PUSHQ:
+	case I_POPQ:
+	    fprintf(fp, "%s", reg_name(ln->ra));
+	    break;
+	case I_JMP:
+	case I_CALL:
+	    print_label(fp, l, ln->label);
+	    break;
+	}
+	fprintf(fp, "\n");
+    }
+    fprintf(fp, "\t.align 8\ndata:\n");
+    for (i = 0; i < DATAWORDS; i++)
+	fprintf(fp, "\t.quad 0x%llx\n", prog->data[i]);
+    fprintf(fp, "\t.pos 0x%llx\nstack:\n", l->stack_addr);
+}
+
+/**********************************************************************
+ * Running and comparing
+ **********************************************************************/
+
+/* Run prog on all three simulators.  Returns OUT_FAIL, and describes the
+   differences in why, if they disagree */
+static outcome_t run_prog(prog_t *prog, word_t *instrsp, char *why)
+{
+    static layout_t l;
+    mem_t image;
+    state_ptr isa, sim;
+    stat_t isa_status = STAT_AOK, status;
+    word_t isa_count, count, limit;
+    outcome_t outcome = OUT_OK;
+    int k;
+
+    layout(prog, &l);
+    image = encode(prog, &l);
+
+    isa = new_state(0);
+    free_mem(isa->m);
+    isa->m = copy_mem(image);
+    for (isa_count = 0; isa_count < instr_limit && isa_status == STAT_AOK;
+	 isa_count++)
+	isa_status = step_state(isa, NULL);
+    *instrsp = isa_count;
+    if (isa_status != STAT_HLT) {
+	/* Loops run too long for the limit */
+	free_state(isa);
+	free_mem(image);
+	return OUT_LIMIT;
+    }
+
+    /* A simulator that goes wrong often never halts.  Give up on it
+       soon after it has done as much as yis */
+    limit = 3 * isa_count + 20;
+    why[0] = '\0';
+    sim = new_state(0);
+    for (k = 0; k < 2; k++) {
+	char *name = k == 0 ? "ssim" : "psim";
+	int n = strlen(why);
+	status = k == 0 ? seq_run(image, limit, sim, &count)
+	    : pipe_run(image, limit, sim, &count);
+	if (status != isa_status)
+	    n += sprintf(why + n, " %s:status", name);
+	if (count != isa_count)
+	    n += sprintf(why + n, " %s:count", name);
+	if (diff_reg(isa->r, sim->r, NULL))
+	    n += sprintf(why + n, " %s:registers", name);
+	if (diff_mem(isa->m, sim->m, NULL))
+	    n += sprintf(why + n, " %s:memory", name);
+	if (sim->cc != isa->cc)
+	    n += sprintf(why + n, " %s:cc", name);
+	if (why[0])
+	    outcome = OUT_FAIL;
+    }
+    free_state(sim);
+    free_state(isa);
+    free_mem(image);
+    return outcome;
+}
+
+static bool_t still_fails(prog_t *prog)
+{
+    word_t instrs;
+    char why[WHY_LEN];
+    return run_prog(prog, &instrs, why) == OUT_FAIL;
+}
+
+/* Remove every piece of list *pp it can, or replace it with its body,
+   while prog still fails.  Returns TRUE if anything changed */
+static bool_t reduce_list(prog_t *prog, piece_t **pp)
+{
+    bool_t changed = FALSE;
+    while (*pp) {
+	piece_t *p = *pp;
+	*pp = p->next;
+	if (still_fails(prog)) {
+	    p->next = NULL;
+	    free_pieces(p);
+	    changed = TRUE;
+	    continue;
+	}
+	*pp = p;
+	if (p->body) {
+	    piece_t *tail;
+	    for (tail = p->body; tail->next; tail = tail->next)
+		;
+	    tail->next = p->next;
+	    *pp = p->body;
+	    if (still_fails(prog)) {
+		p->body = p->next = NULL;
+		free_pieces(p);
+		changed = TRUE;
+		continue;
+	    }
+	    tail->next = NULL;
+	    *pp = p;
+	    changed |= reduce_list(prog, &p->body);
+	}
+	pp = &p->next;
+    }
+    return changed;
+}
+
+static void reduce_prog(prog_t *prog)
+{
+    bool_t changed;
+    int i;
+    do {
+	changed = FALSE;
+	for (i = 0; i < prog->nfuncs; i++)
+	    changed |= reduce_list(prog, &prog->funcs[i]);
+    } while (changed);
+}
+
+/* Run program number i, reducing it and saving it if it fails */
+static void run_job(int i, result_t *r)
+{
+    static layout_t l;
+    prog_t prog;
+    unsigned s = seed + i;
+
+    gen_prog(&prog, s);
+    r->prog = i;
+    r->lines = 0;
+    r->why[0] = '\0';
+    r->outcome = run_prog(&prog, &r->instrs, r->why);
+    if (r->outcome == OUT_FAIL) {
+	char fname[64];
+	FILE *fp;
+	int k;
+
+	if (reduce)
+	    reduce_prog(&prog);
+	layout(&prog, &l);
+	for (k = 0; k < l.nlines; k++)
+	    if (l.lines[k].icode != LABEL_LINE)
+		r->lines++;
+	sprintf(fname, "fuzz-%u.ys", s);
+	fp = fopen(fname, "w");
+	if (fp) {
+	    word_t instrs;
+	    char why[WHY_LEN];
+	    run_prog(&prog, &instrs, why);
+	    fprintf(fp, "# Generated by fuzz -s %u -n 1%s\n", s,
+		    use_iaddq ? " -i" : "");
+	    fprintf(fp, "# Differences:%s\n", why);
+	    print_prog(fp, &prog, &l);
+	    fclose(fp);
+	}
+    }
+    free_prog(&prog);
+}
+
+/*
+ * run_jobs - Run all programs, spread over the worker processes, and
+ * fill in results[] in program order.
+ */
+static void run_jobs(int n, result_t *results)
+{
+    int fd[2];
+    int w, i, got;
+    result_t r;
+
+    if (njobs <= 0)
+	njobs = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (njobs <= 0)
+	njobs = 1;
+    if (njobs > n)
+	njobs = n;
+
+    if (pipe(fd) < 0) {
+	perror("pipe error");
+	exit(1);
+    }
+    for (w = 0; w < njobs; w++) {
+	pid_t pid = fork();
+	if (pid < 0) {
+	    perror("fork error");
+	    exit(1);
+	}
+	if (pid == 0) {
+	    close(fd[0]);
+	    for (i = w; i < n; i += njobs) {
+		run_job(i, &r);
+		/* Records are well under PIPE_BUF, so writes don't interleave */
+		if (write(fd[1], &r, sizeof(r)) != sizeof(r))
+		    _exit(1);
+	    }
+	    _exit(0);
+	}
+    }
+    close(fd[1]);
+
+    for (got = 0; got < n && read(fd[0], &r, sizeof(r)) == sizeof(r); got++)
+	results[r.prog] = r;
+    close(fd[0]);
+    while (wait(NULL) > 0)
+	;
+    if (got < n) {
+	fprintf(stderr, "Only %d of %d programs completed\n", got, n);
+	exit(1);
+    }
+}
+
+static void usage(char *name)
+{
+    printf("Usage: %s [-hqix] [-n N] [-s seed] [-j jobs] [-l m] [-m n]\n", name);
+    printf("   -h      Print this message\n");
+    printf("   -q      Only print the summary\n");
+    printf("   -i      Generate iaddq instructions\n");
+    printf("   -x      Save failing programs without reducing them\n");
+    printf("   -n N    Number of programs to run (default %d)\n", nprogs);
+    printf("   -s seed Seed of the first program; the others follow it (default %u)\n",
+	   seed);
+    printf("   -j jobs Number of worker processes (default one per CPU)\n");
+    printf("   -l m    Set instruction limit per run to m (default %lld)\n",
+	   instr_limit);
+    printf("   -m n    Pieces of code in each main program (default %d)\n",
+	   npieces);
+    exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+    result_t *results;
+    int c, i;
+    int nfail = 0, nlimit = 0;
+    word_t instrs = 0;
+
+    while ((c = getopt(argc, argv, "hqixn:s:j:l:m:")) != -1) {
+	switch(c) {
+	case 'q':
+	    verbose = 0;
+	    break;
+	case 'i':
+	    use_iaddq = TRUE;
+	    break;
+	case 'x':
+	    reduce = FALSE;
+	    break;
+	case 'n':
+	    nprogs = atoi(optarg);
+	    break;
+	case 's':
+	    seed = (unsigned) strtoul(optarg, NULL, 0);
+	    break;
+	case 'j':
+	    njobs = atoi(optarg);
+	    break;
+	case 'l':
+	    instr_limit = atoll(optarg);
+	    break;
+	case 'm':
+	    npieces = atoi(optarg);
+	    break;
+	case 'h':
+	default:
+	    usage(argv[0]);
+	    break;
+	}
+    }
+    if (optind != argc || nprogs < 1 || npieces < 0)
+	usage(argv[0]);
+
+    results = (result_t *) malloc(nprogs * sizeof(result_t));
+    run_jobs(nprogs, results);
+    for (i = 0; i < nprogs; i++) {
+	result_t *r = &results[i];
+	instrs += r->instrs;
+	if (r->outcome == OUT_LIMIT)
+	    nlimit++;
+	if (r->outcome != OUT_FAIL)
+	    continue;
+	nfail++;
+	if (verbose)
+	    printf("Seed %u:%s (%d instructions in fuzz-%u.ys)\n",
+		   seed + i, r->why, r->lines, seed + i);
+    }
+    printf("%d programs, %lld instructions: %d passed, %d failed, %d over the limit\n",
+	   nprogs, instrs, nprogs - nfail - nlimit, nfail, nlimit);
+    free(results);
+    return nfail > 0;
+}
@@ -0,0 +1,54 @@
+/*
+ * simrun.c - Run a processor simulator inside another program
+ *
+ * ssim and psim keep their state in globals, many of them with the same
+ * names, and each has its own main().  To put both into fuzz, each one
+ * is linked with this file into a single object file in which only
+ * RUN_NAME is left global (see the Makefile).  Compile with -DPIPE for
+ * psim, and with the include path of the simulator's sim.h.
+ */
+
+#include <stdio.h>
+
+#include "isa.h"
+#ifdef PIPE
+#include "pipeline.h"
+#include "stages.h"
+#endif
+#include "sim.h"
+
+#ifdef PIPE
+/* sim_run_pipe counts cycles.  This counts what reaches write-back */
+extern word_t instructions;
+#endif
+
+/*
+ * RUN_NAME - Run the program in memory image for at most max_instr
+ * instructions.  The final registers, memory and condition codes are
+ * copied into result, and the number of instructions executed into
+ * *icountp.  Returns the status of the last instruction
+ */
+stat_t RUN_NAME(mem_t image, word_t max_instr, state_ptr result,
+		word_t *icountp)
+{
+    byte_t status = STAT_AOK;
+    cc_t result_cc = DEFAULT_CC;
+    word_t icount;
+
+    sim_reset();
+    free_mem(mem);
+    mem = copy_mem(image);
+#ifdef PIPE
+    sim_run_pipe(max_instr, 5*max_instr, &status, &result_cc);
+    icount = instructions;
+#else
+    icount = sim_run(max_instr, &status, &result_cc);
+#endif
+    free_mem(result->r);
+    free_mem(result->m);
+    result->r = copy_mem(reg);
+    result->m = copy_mem(mem);
+    result->cc = result_cc;
+    *icountp = icount;
+    return (stat_t) status;
+}
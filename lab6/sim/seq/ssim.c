@@ -42,6 +42,7 @@ FILE *object_file;       /* Input file handle */
 bool_t verbosity = 2;    /* Verbosity level [TTY only] (-v) */ 
 word_t instr_limit = 10000; /* Instruction limit [TTY only] (-l) */
 bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
+bool_t compiled = FALSE; /* Use control logic specialized on icode? (-c) */
 
 /************* 
  * End Globals 
@@ -54,6 +55,8 @@ bool_t do_check = FALSE; /* Test with YIS? [TTY only] (-t) */
 
 static void usage(char *name);           /* Print helpful usage message */
 static void run_tty_sim();               /* Run simulator in TTY mode */
+/* Fill in specialized control logic.  Only there if hcl2c ran with -s */
+void spec_init() __attribute__((weak));
 
 #ifdef HAS_GUI
 void addAppCommands(Tcl_Interp *interp); /* Add application-dependent commands */
@@ -83,7 +86,7 @@ int sim_main(int argc, char **argv)
 
     
     /* Parse the command line arguments */
-    while ((c = getopt(argc, argv, "htgl:v:")) != -1) {
+    while ((c = getopt(argc, argv, "htgcl:v:")) != -1) {
 	switch(c) {
 	case 'h':
 	    usage(argv[0]);
@@ -104,6 +107,9 @@ int sim_main(int argc, char **argv)
 	case 'g':
 	    gui_mode = TRUE;
 	    break;
+	case 'c':
+	    compiled = TRUE;
+	    break;
 	default:
 	    printf("Invalid option '%c'\n", c);
 	    usage(argv[0]);
@@ -111,6 +117,13 @@ int sim_main(int argc, char **argv)
 	}
     }
 
+    if (compiled) {
+	if (!spec_init) {
+	    printf("-c needs control logic compiled with hcl2c -s icode\n");
+	    exit(1);
+	}
+	spec_init();
+    }
 
     /* Do we have too many arguments? */
     if (optind < argc - 1) {
@@ -289,13 +302,14 @@ static void run_tty_sim()
  */
 static void usage(char *name)
 {
-    printf("Usage: %s [-htg] [-l m] [-v n] file.yo\n", name);
+    printf("Usage: %s [-htgc] [-l m] [-v n] file.yo\n", name);
     printf("file.yo required in GUI mode, optional in TTY mode (default stdin)\n");
     printf("   -h     Print this message\n");
     printf("   -g     Run in GUI mode instead of TTY mode (default TTY)\n");  
     printf("   -l m   Set instruction limit to m [TTY mode only] (default %lld)\n", instr_limit);
     printf("   -v n   Set verbosity level to 0 <= n <= 2 [TTY mode only] (default %d)\n", verbosity);
     printf("   -t     Test result against ISA simulator (yis) [TTY mode only]\n");
+    printf("   -c     Use control logic specialized on icode\n");
     exit(0);
 }
 
@@ -398,6 +412,39 @@ word_t gen_mem_write();
 word_t gen_Stat();
 word_t gen_new_pc();
 
+/*
+ * The same, specialized on icode by hcl2c -s icode.  For each value of
+ * icode, spec_X_fn gives the function computing what is left of X, or
+ * NULL if X is then the constant in spec_X_val.  The tables are weak,
+ * so that HCL compiled without -s, or lacking a definition, still
+ * links; a missing table is NULL and X is then computed in full.
+ */
+#define SPEC(sig) \
+    extern word_t (*spec_##sig##_fn[])() __attribute__((weak)); \
+    extern word_t spec_##sig##_val[] __attribute__((weak))
+SPEC(instr_valid);
+SPEC(need_regids);
+SPEC(need_valC);
+SPEC(srcA);
+SPEC(srcB);
+SPEC(dstE);
+SPEC(dstM);
+SPEC(aluA);
+SPEC(aluB);
+SPEC(alufun);
+SPEC(set_cc);
+SPEC(mem_addr);
+SPEC(mem_data);
+SPEC(mem_read);
+SPEC(mem_write);
+SPEC(Stat);
+SPEC(new_pc);
+
+/* Value of control signal sig, once icode is known */
+#define CONTROL(sig) \
+    (!compiled || !spec_##sig##_fn ? gen_##sig() : spec_##sig##_fn[icode] ? \
+     spec_##sig##_fn[icode]() : spec_##sig##_val[icode])
+
 /* Log file */
 FILE *dumpfile = NULL;
 
@@ -681,9 +728,9 @@ static byte_t sim_step()
     imem_ifun = LO4(instr);
     icode = gen_icode();
     ifun  = gen_ifun();
-    instr_valid = gen_instr_valid();
+    instr_valid = CONTROL(instr_valid);
     valp++;
-    if (gen_need_regids()) {
+    if (CONTROL(need_regids)) {
 	byte_t regids;
 	if (get_byte_val(mem, valp, &regids)) {
 	    ra = GET_RA(regids);
@@ -700,7 +747,7 @@ static byte_t sim_step()
 	rb = REG_NONE;
     }
 
-    if (gen_need_valC()) {
+    if (CONTROL(need_valC)) {
 	if (get_word_val(mem, valp, &valc)) {
 	} else {
 	    valc = 0;
@@ -718,14 +765,14 @@ static byte_t sim_step()
 	status = STAT_HLT;
     }
     
-    srcA = gen_srcA();
+    srcA = CONTROL(srcA);
     if (srcA != REG_NONE) {
 	vala = get_reg_val(reg, srcA);
     } else {
 	vala = 0;
     }
     
-    srcB = gen_srcB();
+    srcB = CONTROL(srcB);
     if (srcB != REG_NONE) {
 	valb = get_reg_val(reg, srcB);
     } else {
@@ -734,24 +781,24 @@ static byte_t sim_step()
 
     cond = cond_holds(cc, ifun);
 
-    destE = gen_dstE();
-    destM = gen_dstM();
+    destE = CONTROL(dstE);
+    destM = CONTROL(dstM);
 
-    aluA = gen_aluA();
-    aluB = gen_aluB();
-    alufun = gen_alufun();
+    aluA = CONTROL(aluA);
+    aluB = CONTROL(aluB);
+    alufun = CONTROL(alufun);
     vale = compute_alu(alufun, aluA, aluB);
     cc_in = cc;
-    if (gen_set_cc())
+    if (CONTROL(set_cc))
 	cc_in = compute_cc(alufun, aluA, aluB);
 
     bcond =  cond && (icode == I_JMP);
 
-    mem_addr = gen_mem_addr();
-    mem_data = gen_mem_data();
+    mem_addr = CONTROL(mem_addr);
+    mem_data = CONTROL(mem_data);
 
 
-    if (gen_mem_read()) {
+    if (CONTROL(mem_read)) {
       dmem_error = dmem_error || !get_word_val(mem, mem_addr, &valm);
       if (dmem_error) {
 	sim_log("Couldn't read at address 0x%llx\n", mem_addr);
@@ -759,14 +806,14 @@ static byte_t sim_step()
     } else
       valm = 0;
 
-    mem_write = gen_mem_write();
+    mem_write = CONTROL(mem_write);
     if (mem_write) {
       /* Do a test read of the data memory to make sure address is OK */
       word_t junk;
       dmem_error = dmem_error || !get_word_val(mem, mem_addr, &junk);
     }
 
-    status = gen_Stat();
+    status = CONTROL(Stat);
 
     if (plusmode) {
 	prev_icode_in = icode;
@@ -777,7 +824,7 @@ static byte_t sim_step()
 	prev_bcond_in = bcond;
     } else {
 	/* Update PC */
-	pc_in = gen_new_pc();
+	pc_in = CONTROL(new_pc);
     } 
     sim_report();
     return status;
@@ -5,168 +5,1969 @@
  * ID: 519021910475
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <unistd.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "cachelab.h"
 
-#define MAXLINE 1024
+#define MAXLINE 1024
+#define READ_BLOCK (1 << 20)	/* bytes per read() if mmap fails */
+
+/*
+ * Binary traces (-w) start with BIN_MAGIC, followed by blocks of up to
+ * BIN_BLOCK records.  A block is a 4-byte record count and a 4-byte
+ * length in bytes (both little-endian), then the records.  A record is
+ * one byte holding the op in bits 0-1 (I, L, S, M) and the size in bits
+ * 2-7, with 63 meaning the size follows as a varint, then the change
+ * from the previous address of the same kind (instruction or data) as a
+ * zigzag varint.  The previous addresses restart at 0 in every block
+ */
+#define BIN_MAGIC "CSIMTRC1"
+#define BIN_MAGIC_LEN 8
+#define BIN_BLOCK 16384
+#define BIN_RECORD_MAX 16	/* op/size byte, size varint, address varint */
+
+#define MAXCONFIG 256		/* configurations for -c */
+
+#define MAXTHREAD 64		/* threads for -j */
+#define BATCH 4096		/* addresses handed to a thread at once */
+#define QUEUE 8			/* batches a thread may have waiting */
+
+/* args */
+int verbose = 0;
+int setbit = 1;
+long setnum = 2;
+long linenum = 1;
+int blockbit = 1;
+char tracefile[MAXLINE];
+int parse_rounds = 0;		/* -p: only time the parser */
+char binfile[MAXLINE];		/* -w: convert the trace to binary */
+int nthread = 1;		/* -j: simulating threads */
+int nconfig = 0;		/* -c: configurations to sweep */
+struct config {
+    int s, b;
+    long E;
+    int group;			/* stack group simulating it */
+} configs[MAXCONFIG];
+
+/* result, kept by each simulating thread */
+struct counts {
+    long hits;
+    long misses;
+    long evictions;
+    unsigned long stamp;	/* time stamp for LRU */
+};
+struct counts counts;
+long record_count = 0;
+
+/*
+ * cache storage - one contiguous array of tags, set after set, with a
+ * parallel array of LRU stamps.  A stamp of 0 marks an empty line, and
+ * empty lines hold EMPTY_TAG.  Lines fill from the front of a set and
+ * are never emptied, so the lowest stamp in a set is its first empty
+ * line if it has one and its least recently used line otherwise
+ */
+#define EMPTY_TAG (~0ul)
+#define SIMD_WAYS 8		/* compare tags with SSE2 from this many lines */
+
+unsigned long *tags = NULL;
+unsigned long *stamps = NULL;
+unsigned long set_mask;
+unsigned long *set_bits = NULL;	/* for policies other than LRU */
+long *set_fill = NULL;
+
+/*
+ * usage - print help message
+ */
+void usage() 
+{
+    printf("Usage: shell [-hvz] [-p <n>] [-r <n> [-y <symfile>]] [-w <binfile>] [-j <n>] [-R <policy>] [-c <list>] [-H <levels> [-I <l1i>] [-P <policy>] [-W <policy>] [-M <n>]] -s <s> -E <E> -b <b> -t <tracefile>\n");
+    printf("   -h   print this message\n");
+    printf("   -v   display trace info\n");
+    printf("   -s   number of set index bits\n");
+    printf("   -E   number of lines per set\n");
+    printf("   -b   number of block bits\n");
+    printf("   -t   name of the valgrind trace to replay\n");
+    printf("   -p n parse the trace n times without simulating, "
+	   "report lines/second\n");
+    printf("   -w f write the trace to file f in binary form, "
+	   "which -t also reads\n");
+    printf("   -j n simulate the sets in n threads\n");
+    printf("   -z   split accesses over the blocks they span, "
+	   "and report how many do\n");
+    printf("   -r n report each set, the kinds of miss and the n pairs "
+	   "of blocks\n        evicting each other most\n");
+    printf("   -y f with -r, count by the symbols in file f "
+	   "(nm -S output)\n");
+    printf("   -R p replacement policy: lru, fifo, random, plru, lfu, srrip "
+	   "or opt\n");
+    printf("   -c l simulate every configuration \"s,E,b ...\" in list l "
+	   "instead of -s -E -b\n");
+    printf("   -H l simulate the hierarchy \"s,E,b[,lat] ...\" of L1D, L2, ... "
+	   "instead of -s -E -b\n");
+    printf("   -I c with -H, a separate L1I \"s,E,b[,lat]\" for I records\n");
+    printf("   -P p with -H, inclusion policy: incl, nine or excl\n");
+    printf("   -W w with -H, write policy: wb (write back) or wt "
+	   "(write through)\n");
+    printf("   -M n with -H, memory latency in cycles\n");
+    exit(1);
+}
+
+/*
+ * alloc_or_die - return p, the result of an allocation, unless it failed
+ */
+static void *alloc_or_die(void *p)
+{
+    if (!p) {
+	printf("out of memory");
+	exit(-1);
+    }
+    return p;
+}
+
+/*
+ * hash - scatter x (a block number) over a power-of-2 sized table
+ */
+static inline unsigned long hash(unsigned long x)
+{
+    return (x * 0x9e3779b97f4a7c15ul) >> 20;
+}
+
+/*
+ * init_cache - initialize the cache
+ */
+void init_cache()
+{
+    tags = alloc_or_die(malloc(sizeof(unsigned long) * setnum * linenum));
+    stamps = alloc_or_die(calloc(setnum * linenum, sizeof(unsigned long)));
+    set_bits = alloc_or_die(calloc(setnum, sizeof(unsigned long)));
+    set_fill = alloc_or_die(calloc(setnum, sizeof(long)));
+    for (long i = 0; i < setnum * linenum; ++i)
+	tags[i] = EMPTY_TAG;
+    set_mask = (0x1ul << setbit) - 0x1;
+}
+
+/* 
+ * free_cache - free the cache
+ */
+void free_cache()
+{
+    free(tags);
+    free(stamps);
+    free(set_bits);
+    free(set_fill);
+}
+
+/*
+ * find_tag - index of the first line of t[0..n) holding tag, or -1
+ */
+static inline long find_tag(const unsigned long *t, long n, unsigned long tag)
+{
+    long i = 0;
+#ifdef __SSE2__
+    /* SSE2 has no 64-bit compare: a lane matches when both of its
+       32-bit halves do */
+    if (n >= SIMD_WAYS) {
+	__m128i key = _mm_set1_epi64x(tag);
+	for (; i + 4 <= n; i += 4) {
+	    __m128i a = _mm_loadu_si128((const __m128i *) (t + i));
+	    __m128i b = _mm_loadu_si128((const __m128i *) (t + i + 2));
+	    a = _mm_cmpeq_epi32(a, key);
+	    b = _mm_cmpeq_epi32(b, key);
+	    a = _mm_and_si128(a, _mm_shuffle_epi32(a, _MM_SHUFFLE(2, 3, 0, 1)));
+	    b = _mm_and_si128(b, _mm_shuffle_epi32(b, _MM_SHUFFLE(2, 3, 0, 1)));
+	    int m = _mm_movemask_pd(_mm_castsi128_pd(a)) |
+		(_mm_movemask_pd(_mm_castsi128_pd(b)) << 2);
+	    if (m)
+		return i + __builtin_ctz(m);
+	}
+    }
+#endif
+    for (; i < n; ++i)
+	if (t[i] == tag)
+	    return i;
+    return -1;
+}
+
+/*
+ * touch_counted - simulate address visit, counting it in c
+ */
+static inline void touch_counted(unsigned long address, struct counts *c)
+{
+    /* simulate time stamp */
+    unsigned long curr_stamp = ++c->stamp;
+
+    /* split address */
+    long base = ((address >> blockbit) & set_mask) * linenum;
+    unsigned long tag = (address >> blockbit) >> setbit;
+    unsigned long *t = tags + base, *st = stamps + base;
+
+    /* find tag in corresponding set; if hit, update stamp */
+    long victim = find_tag(t, linenum, tag);
+    if (victim >= 0 && st[victim]) {
+	st[victim] = curr_stamp;
+	++c->hits;
+	return;
+    }
+    ++c->misses; /* else miss */
+
+    /* A match on an empty line can only happen with no set or block
+       bits, where a real tag can equal EMPTY_TAG.  It is the first
+       empty line, so it takes the block.  Otherwise one pass over the
+       stamps finds the first empty line or else the LRU line */
+    if (victim < 0) {
+	victim = 0;
+	for (long i = 1; i < linenum; ++i)
+	    if (st[i] < st[victim])
+		victim = i;
+    }
+    if (st[victim])
+	++c->evictions; /* else eviction */
+
+    /* replace the victim line */
+    t[victim] = tag;
+    st[victim] = curr_stamp;
+}
+
+/*
+ * touch - simulate address visit
+ */
+void touch(unsigned long address)
+{
+    touch_counted(address, &counts);
+}
+
+/*
+ * replacement policies - LRU is simulated by touch_counted above.  The
+ * others keep one word of state per line (meta, in the stamps array)
+ * and one per set (set_bits), and count the lines each set has filled
+ * (set_fill), which are the first ones in the set.  A policy updates
+ * a line's state when it is filled or hit, and picks the victim when
+ * its set is full:
+ *   fifo    meta is the fill time; evict the oldest fill
+ *   random  evict any line
+ *   plru    tree pseudo-LRU: set_bits holds the E-1 tree bits (E a
+ *           power of 2 up to 64), each pointing away from the half
+ *           used last; evict where the bits point
+ *   lfu     meta is the use count above the last use time; evict the
+ *           least used line, least recently used among equals
+ *   srrip   meta is a 2-bit re-reference prediction: 2 on fill, 0 on a
+ *           hit; evict a line at 3, ageing the set until there is one
+ *   opt     Belady: meta is the trace position of the block's next use;
+ *           evict the line used furthest ahead (or never)
+ */
+#define LFU_SHIFT 40		/* lfu: use count above a 40-bit time */
+#define RRPV_MAX 3		/* srrip: 2-bit predictions */
+#define NEVER (~0ul)		/* opt: no next use */
+
+struct policy {
+    char *name;
+    /* update line way of a set for a fill or hit at time now, next
+       used at position next */
+    void (*update)(unsigned long *meta, unsigned long *bits, long way,
+		   int hit, unsigned long now, unsigned long next);
+    /* victim in a full set */
+    long (*victim)(unsigned long *meta, unsigned long *bits);
+};
+
+int plru_levels;		/* plru: log2(E) */
+unsigned long rand_state = 88172645463325252ul;
+
+static long min_meta(unsigned long *meta, unsigned long *bits)
+{
+    long victim = 0;
+    for (long i = 1; i < linenum; ++i)
+	if (meta[i] < meta[victim])
+	    victim = i;
+    return victim;
+}
+
+static void fifo_update(unsigned long *meta, unsigned long *bits, long way,
+			int hit, unsigned long now, unsigned long next)
+{
+    if (!hit)
+	meta[way] = now;
+}
+
+static void no_update(unsigned long *meta, unsigned long *bits, long way,
+		      int hit, unsigned long now, unsigned long next)
+{
+}
+
+static long random_victim(unsigned long *meta, unsigned long *bits)
+{
+    /* xorshift64 */
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return rand_state % linenum;
+}
+
+static void plru_update(unsigned long *meta, unsigned long *bits, long way,
+			int hit, unsigned long now, unsigned long next)
+{
+    unsigned long node = 1;
+    for (int d = plru_levels - 1; d >= 0; --d) {
+	unsigned long dir = (way >> d) & 1;
+	if (dir)
+	    *bits &= ~(1ul << node);
+	else
+	    *bits |= 1ul << node;
+	node = 2 * node + dir;
+    }
+}
+
+static long plru_victim(unsigned long *meta, unsigned long *bits)
+{
+    unsigned long node = 1;
+    long way = 0;
+    for (int d = 0; d < plru_levels; ++d) {
+	unsigned long dir = (*bits >> node) & 1;
+	way = 2 * way + dir;
+	node = 2 * node + dir;
+    }
+    return way;
+}
+
+static void lfu_update(unsigned long *meta, unsigned long *bits, long way,
+		       int hit, unsigned long now, unsigned long next)
+{
+    unsigned long uses = hit ? meta[way] >> LFU_SHIFT : 0;
+    if (uses < (1ul << (64 - LFU_SHIFT)) - 1)
+	++uses;
+    meta[way] = uses << LFU_SHIFT | (now & ((1ul << LFU_SHIFT) - 1));
+}
+
+static void srrip_update(unsigned long *meta, unsigned long *bits, long way,
+			 int hit, unsigned long now, unsigned long next)
+{
+    meta[way] = hit ? 0 : RRPV_MAX - 1;
+}
+
+static long srrip_victim(unsigned long *meta, unsigned long *bits)
+{
+    for (;;) {
+	for (long i = 0; i < linenum; ++i)
+	    if (meta[i] == RRPV_MAX)
+		return i;
+	for (long i = 0; i < linenum; ++i)
+	    ++meta[i];
+    }
+}
+
+static void opt_update(unsigned long *meta, unsigned long *bits, long way,
+		       int hit, unsigned long now, unsigned long next)
+{
+    meta[way] = next;
+}
+
+static long opt_victim(unsigned long *meta, unsigned long *bits)
+{
+    long victim = 0;
+    for (long i = 1; i < linenum; ++i)
+	if (meta[i] > meta[victim])
+	    victim = i;
+    return victim;
+}
+
+struct policy policies[] = {
+    { "lru", NULL, NULL },	/* touch_counted */
+    { "fifo", fifo_update, min_meta },
+    { "random", no_update, random_victim },
+    { "plru", plru_update, plru_victim },
+    { "lfu", lfu_update, min_meta },
+    { "srrip", srrip_update, srrip_victim },
+    { "opt", opt_update, opt_victim },
+};
+#define NPOLICY (sizeof(policies) / sizeof(policies[0]))
+
+struct policy *policy = &policies[0];
+
+/*
+ * touch_policy - simulate address visit under a policy other than LRU;
+ * next is the trace position of the block's next use, for opt
+ */
+void touch_policy(unsigned long address, unsigned long next)
+{
+    unsigned long now = ++counts.stamp;
+    unsigned long set = (address >> blockbit) & set_mask;
+    unsigned long tag = (address >> blockbit) >> setbit;
+    unsigned long *t = tags + set * linenum, *meta = stamps + set * linenum;
+    long n = set_fill[set];
+
+    long way = find_tag(t, n, tag);
+    if (way >= 0) {
+	++counts.hits;
+	policy->update(meta, &set_bits[set], way, 1, now, next);
+	return;
+    }
+    ++counts.misses;
+    if (n < linenum)
+	way = set_fill[set]++;
+    else {
+	++counts.evictions;
+	way = policy->victim(meta, &set_bits[set]);
+    }
+    t[way] = tag;
+    policy->update(meta, &set_bits[set], way, 0, now, next);
+}
+
+void touch_other(unsigned long address)
+{
+    touch_policy(address, 0);
+}
+
+/*
+ * miss report (-r) - counts for each set, misses sorted into the three
+ * Cs, the pairs of blocks that evict each other most often, and with -y
+ * the counts for each source symbol.  A miss is compulsory on the first
+ * use of its block, a capacity miss if a fully associative LRU cache of
+ * the same size (the shadow) misses too, and a conflict miss otherwise.
+ * Each access is simulated as usual between report_pre, which saves the
+ * tags of its set, and report_post, which works out what happened
+ */
+enum { C_HIT, C_COMPULSORY, C_CAPACITY, C_CONFLICT, NCLASS };
+static const char *class_names[NCLASS] = {
+    "hits", "compulsory", "capacity", "conflict"
+};
+
+int report_pairs = 0;		/* -r: pairs to list; 0 for no report */
+char symfile[MAXLINE];		/* -y: symbols to count accesses by */
+void (*reported)(unsigned long address);	/* simulates for the report */
+
+struct set_counts {
+    long hits;
+    long misses;
+    long evictions;
+} *set_counts = NULL;
+long class_counts[NCLASS];
+unsigned long *saved_tags = NULL;	/* the set before the access */
+struct counts counts_before;
+
+/* every block used, found through a hash table of indices; those in the
+   shadow are on a list from most to least recently used */
+struct block_use {
+    unsigned long block;
+    long prev, next;
+    int resident;
+} *blocks = NULL;
+long nblock = 0, max_block = 0;
+long *block_index = NULL;
+unsigned long block_slots = 0;
+long shadow_head = -1, shadow_tail = -1, shadow_size = 0;
+
+/* pairs of blocks, lower first, and how often one evicted the other */
+struct pair {
+    unsigned long a, b;
+    long n;
+} *pairs = NULL;
+unsigned long pair_slots = 0, npair = 0;
+
+struct symbol {
+    unsigned long start, size;
+    char *name;
+    long counts[NCLASS];
+} *symbols = NULL;
+long nsymbol = 0;
+long other_counts[NCLASS];	/* accesses outside every symbol */
+
+
+/*
+ * find_block - index of block in blocks, adding it if new
+ */
+long find_block(unsigned long block, int *seen)
+{
+    if (2 * nblock >= (long) block_slots) {
+	/* grow the table */
+	free(block_index);
+	block_slots = block_slots ? 2 * block_slots : 1 << 16;
+	block_index = alloc_or_die(malloc(sizeof(long) * block_slots));
+	memset(block_index, -1, sizeof(long) * block_slots);
+	for (long i = 0; i < nblock; ++i) {
+	    unsigned long h = hash(blocks[i].block);
+	    while (block_index[h & (block_slots - 1)] >= 0)
+		++h;
+	    block_index[h & (block_slots - 1)] = i;
+	}
+    }
+    unsigned long h = hash(block);
+    long i;
+    while ((i = block_index[h & (block_slots - 1)]) >= 0) {
+	if (blocks[i].block == block) {
+	    *seen = 1;
+	    return i;
+	}
+	++h;
+    }
+    if (nblock == max_block) {
+	max_block = max_block ? 2 * max_block : 1 << 15;
+	blocks = alloc_or_die(realloc(blocks,
+				      sizeof(struct block_use) * max_block));
+    }
+    i = nblock++;
+    blocks[i].block = block;
+    blocks[i].resident = 0;
+    block_index[h & (block_slots - 1)] = i;
+    *seen = 0;
+    return i;
+}
+
+static void shadow_unlink(long i)
+{
+    if (blocks[i].prev >= 0)
+	blocks[blocks[i].prev].next = blocks[i].next;
+    else
+	shadow_head = blocks[i].next;
+    if (blocks[i].next >= 0)
+	blocks[blocks[i].next].prev = blocks[i].prev;
+    else
+	shadow_tail = blocks[i].prev;
+}
+
+/*
+ * shadow_touch - use block i in the shadow cache; returns 1 on a hit
+ */
+int shadow_touch(long i)
+{
+    int hit = blocks[i].resident;
+    if (hit)
+	shadow_unlink(i);
+    else if (shadow_size == setnum * linenum) {
+	blocks[shadow_tail].resident = 0;
+	shadow_unlink(shadow_tail);
+    } else
+	++shadow_size;
+    blocks[i].resident = 1;
+    blocks[i].prev = -1;
+    blocks[i].next = shadow_head;
+    if (shadow_head >= 0)
+	blocks[shadow_head].prev = i;
+    else
+	shadow_tail = i;
+    shadow_head = i;
+    return hit;
+}
+
+/*
+ * add_pair - count block a evicting block b
+ */
+void add_pair(unsigned long a, unsigned long b)
+{
+    if (a > b) {
+	unsigned long t = a;
+	a = b;
+	b = t;
+    }
+    if (2 * npair >= pair_slots) {
+	/* grow the table */
+	struct pair *old = pairs;
+	unsigned long old_slots = pair_slots;
+	pair_slots = pair_slots ? 2 * pair_slots : 1 << 12;
+	pairs = alloc_or_die(calloc(pair_slots, sizeof(struct pair)));
+	for (unsigned long k = 0; k < old_slots; ++k) {
+	    if (!old[k].n)
+		continue;
+	    unsigned long h = hash(old[k].a ^ hash(old[k].b));
+	    while (pairs[h & (pair_slots - 1)].n)
+		++h;
+	    pairs[h & (pair_slots - 1)] = old[k];
+	}
+	free(old);
+    }
+    unsigned long h = hash(a ^ hash(b));
+    struct pair *p;
+    for (;; ++h) {
+	p = &pairs[h & (pair_slots - 1)];
+	if (!p->n || (p->a == a && p->b == b))
+	    break;
+    }
+    if (!p->n) {
+	p->a = a;
+	p->b = b;
+	++npair;
+    }
+    ++p->n;
+}
+
+/*
+ * find_symbol - the symbol holding address, or NULL
+ */
+struct symbol *find_symbol(unsigned long address)
+{
+    long lo = 0, hi = nsymbol;	/* last start <= address is below hi */
+    while (lo < hi) {
+	long mid = (lo + hi) / 2;
+	if (symbols[mid].start <= address)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    if (lo > 0 && address - symbols[lo - 1].start < symbols[lo - 1].size)
+	return &symbols[lo - 1];
+    return NULL;
+}
+
+static int by_start(const void *x, const void *y)
+{
+    const struct symbol *a = x, *b = y;
+    return a->start < b->start ? -1 : a->start > b->start;
+}
+
+/*
+ * read_symbols - read symfile, as printed by nm -S ("start size type
+ * name") or as "start size name", in hex
+ */
+void read_symbols()
+{
+    FILE *fp = fopen(symfile, "r");
+    char line[MAXLINE], name[MAXLINE], type;
+    unsigned long start, size;
+    long max_symbol = 0;
+
+    if (!fp) {
+	printf("%s: No such file or directory\n", symfile);
+	exit(1);
+    }
+    while (fgets(line, MAXLINE, fp)) {
+	if (sscanf(line, "%lx %lx %c %s", &start, &size, &type, name) != 4 &&
+	    sscanf(line, "%lx %lx %s", &start, &size, name) != 3)
+	    continue;
+	if (nsymbol == max_symbol) {
+	    max_symbol = max_symbol ? 2 * max_symbol : 64;
+	    symbols = alloc_or_die(realloc(symbols,
+					   sizeof(struct symbol) * max_symbol));
+	}
+	memset(&symbols[nsymbol], 0, sizeof(struct symbol));
+	symbols[nsymbol].start = start;
+	symbols[nsymbol].size = size;
+	symbols[nsymbol].name = alloc_or_die(strdup(name));
+	++nsymbol;
+    }
+    fclose(fp);
+    qsort(symbols, nsymbol, sizeof(struct symbol), by_start);
+}
+
+void init_report()
+{
+    set_counts = alloc_or_die(calloc(setnum, sizeof(struct set_counts)));
+    saved_tags = alloc_or_die(malloc(sizeof(unsigned long) * linenum));
+    if (symfile[0])
+	read_symbols();
+}
+
+/*
+ * report_pre - note the state before simulating address
+ */
+static inline void report_pre(unsigned long address)
+{
+    unsigned long set = (address >> blockbit) & set_mask;
+    memcpy(saved_tags, tags + set * linenum, sizeof(unsigned long) * linenum);
+    counts_before = counts;
+}
+
+/*
+ * report_post - count what simulating address did
+ */
+static inline void report_post(unsigned long address)
+{
+    unsigned long block = address >> blockbit;
+    unsigned long set = block & set_mask;
+    int seen;
+    int shadow_hit = shadow_touch(find_block(block, &seen));
+    int class;
+
+    if (counts.hits != counts_before.hits) {
+	class = C_HIT;
+	++set_counts[set].hits;
+    } else {
+	class = !seen ? C_COMPULSORY : !shadow_hit ? C_CAPACITY : C_CONFLICT;
+	++set_counts[set].misses;
+    }
+    if (counts.evictions != counts_before.evictions) {
+	/* the victim was where the block is now */
+	long way = find_tag(tags + set * linenum, linenum, block >> setbit);
+	add_pair(block, (saved_tags[way] << setbit) | set);
+	++set_counts[set].evictions;
+    }
+    ++class_counts[class];
+    if (nsymbol) {
+	struct symbol *sym = find_symbol(address);
+	++(sym ? sym->counts : other_counts)[class];
+    }
+}
+
+/*
+ * touch_reported - simulate address visit for the report
+ */
+void touch_reported(unsigned long address)
+{
+    report_pre(address);
+    reported(address);
+    report_post(address);
+}
+
+/*
+ * block_name - print block's address into buf, with its symbol if known
+ */
+void block_name(char *buf, unsigned long block)
+{
+    unsigned long address = block << blockbit;
+    struct symbol *sym = nsymbol ? find_symbol(address) : NULL;
+    if (sym)
+	sprintf(buf, "%#lx %s+0x%lx", address, sym->name, address - sym->start);
+    else
+	sprintf(buf, "%#lx", address);
+}
+
+static int by_count(const void *x, const void *y)
+{
+    const struct pair *a = x, *b = y;
+    return a->n > b->n ? -1 : a->n < b->n;
+}
+
+/*
+ * print_report - print the report after the summary
+ */
+void print_report()
+{
+    long most = 1;
+    char a[MAXLINE], b[MAXLINE];
+
+    printf("misses: compulsory:%ld capacity:%ld conflict:%ld\n",
+	   class_counts[C_COMPULSORY], class_counts[C_CAPACITY],
+	   class_counts[C_CONFLICT]);
+
+    /* sets, with a bar of their misses against the worst set */
+    for (long i = 0; i < setnum; ++i)
+	if (set_counts[i].misses > most)
+	    most = set_counts[i].misses;
+    printf("%8s %10s %10s %10s  misses\n", "set", "hits", "misses",
+	   "evictions");
+    for (long i = 0; i < setnum; ++i) {
+	struct set_counts *sc = &set_counts[i];
+	if (!sc->hits && !sc->misses)
+	    continue;
+	int bar = (int) ((sc->misses * 40 + most - 1) / most);
+	printf("%8ld %10ld %10ld %10ld  %.*s\n", i, sc->hits, sc->misses,
+	       sc->evictions, bar, "########################################");
+    }
+
+    /* pairs, most evictions first */
+    long n = 0;
+    for (unsigned long k = 0; k < pair_slots; ++k)
+	if (pairs[k].n)
+	    pairs[n++] = pairs[k];
+    qsort(pairs, n, sizeof(struct pair), by_count);
+    if (n > report_pairs)
+	n = report_pairs;
+    if (n > 0)
+	printf("%10s  %-28s %-28s\n", "evictions", "block", "block");
+    for (long k = 0; k < n; ++k) {
+	block_name(a, pairs[k].a);
+	block_name(b, pairs[k].b);
+	printf("%10ld  %-28s %-28s\n", pairs[k].n, a, b);
+    }
+
+    /* symbols */
+    if (nsymbol) {
+	printf("%-20s", "symbol");
+	for (int c = 0; c < NCLASS; ++c)
+	    printf(" %10s", class_names[c]);
+	printf("\n");
+	for (long i = 0; i <= nsymbol; ++i) {
+	    long *sc = i < nsymbol ? symbols[i].counts : other_counts;
+	    if (i < nsymbol && !sc[C_HIT] && !sc[C_COMPULSORY])
+		continue;
+	    printf("%-20s", i < nsymbol ? symbols[i].name : "(other)");
+	    for (int c = 0; c < NCLASS; ++c)
+		printf(" %10ld", sc[c]);
+	    printf("\n");
+	}
+    }
+}
+
+void free_report()
+{
+    for (long i = 0; i < nsymbol; ++i)
+	free(symbols[i].name);
+    free(symbols);
+    free(pairs);
+    free(blocks);
+    free(block_index);
+    free(saved_tags);
+    free(set_counts);
+}
+
+/*
+ * opt - Belady's replacement needs the future, so the accesses are
+ * collected first, then each one's next use of the same block found
+ * by walking back through them with a hash table of blocks
+ */
+unsigned long *opt_addrs = NULL;
+long opt_n = 0, opt_max = 0;
+
+void opt_collect(unsigned long address)
+{
+    if (opt_n == opt_max) {
+	opt_max = opt_max ? 2 * opt_max : 1 << 16;
+	opt_addrs = alloc_or_die(realloc(opt_addrs,
+					 sizeof(unsigned long) * opt_max));
+    }
+    opt_addrs[opt_n++] = address;
+}
+
+void opt_run()
+{
+    unsigned long *next = alloc_or_die(malloc(sizeof(unsigned long) *
+					      (opt_n + 1)));
+    unsigned long size = 1 << 16, used = 0;
+    unsigned long *keys = alloc_or_die(malloc(sizeof(unsigned long) * size));
+    long *pos = alloc_or_die(malloc(sizeof(long) * size));
+    memset(pos, -1, sizeof(long) * size);
+
+    for (long i = opt_n - 1; i >= 0; --i) {
+	if (2 * used >= size) {
+	    /* grow the table */
+	    unsigned long *okeys = keys;
+	    long *opos = pos;
+	    unsigned long osize = size;
+	    size *= 2;
+	    keys = alloc_or_die(malloc(sizeof(unsigned long) * size));
+	    pos = alloc_or_die(malloc(sizeof(long) * size));
+	    memset(pos, -1, sizeof(long) * size);
+	    for (unsigned long k = 0; k < osize; ++k) {
+		if (opos[k] < 0)
+		    continue;
+		unsigned long h = hash(okeys[k]);
+		while (pos[h & (size - 1)] >= 0)
+		    ++h;
+		keys[h & (size - 1)] = okeys[k];
+		pos[h & (size - 1)] = opos[k];
+	    }
+	    free(okeys);
+	    free(opos);
+	}
+	unsigned long block = opt_addrs[i] >> blockbit;
+	unsigned long h = hash(block);
+	while (pos[h & (size - 1)] >= 0 && keys[h & (size - 1)] != block)
+	    ++h;
+	h &= size - 1;
+	if (pos[h] < 0) {
+	    keys[h] = block;
+	    ++used;
+	    next[i] = NEVER;
+	} else
+	    next[i] = pos[h];
+	pos[h] = i;
+    }
+    free(keys);
+    free(pos);
+
+    for (long i = 0; i < opt_n; ++i) {
+	if (report_pairs)
+	    report_pre(opt_addrs[i]);
+	touch_policy(opt_addrs[i], next[i]);
+	if (report_pairs)
+	    report_post(opt_addrs[i]);
+    }
+    free(next);
+    free(opt_addrs);
+}
+
+/*
+ * set_policy - select replacement policy name
+ */
+void set_policy(char *name)
+{
+    for (unsigned i = 0; i < NPOLICY; ++i)
+	if (strcmp(name, policies[i].name) == 0) {
+	    policy = &policies[i];
+	    return;
+	}
+    usage();
+}
+
+/*
+ * workers - for -j, each thread simulates a contiguous run of sets,
+ * set i going to thread i * nthread / setnum, so that no two threads
+ * write to the same cache line of tags or stamps.  Sets share nothing
+ * under LRU, and each thread sees the accesses to its sets in trace
+ * order, so the counts add up to those of one thread.
+ * The reader fills a batch of addresses for each thread and queues it
+ * when full.  Batches live in a ring of QUEUE slots per thread: slots
+ * head..head+count-1 are queued and the reader fills slot tail
+ */
+struct worker {
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;	/* a batch was queued, or done */
+    pthread_cond_t space;	/* a batch was finished */
+    unsigned long *batch[QUEUE];
+    long len[QUEUE];
+    int head, count, tail;
+    long nfill;			/* addresses in slot tail */
+    int done;			/* no more batches */
+    struct counts counts;
+} workers[MAXTHREAD];
+
+void *work(void *arg)
+{
+    struct worker *w = arg;
+    for (;;) {
+	pthread_mutex_lock(&w->lock);
+	while (w->count == 0 && !w->done)
+	    pthread_cond_wait(&w->ready, &w->lock);
+	if (w->count == 0) {
+	    pthread_mutex_unlock(&w->lock);
+	    return NULL;
+	}
+	int i = w->head;
+	pthread_mutex_unlock(&w->lock);
+
+	for (long k = 0; k < w->len[i]; ++k)
+	    touch_counted(w->batch[i][k], &w->counts);
+
+	pthread_mutex_lock(&w->lock);
+	w->head = (w->head + 1) % QUEUE;
+	--w->count;
+	pthread_cond_signal(&w->space);
+	pthread_mutex_unlock(&w->lock);
+    }
+}
+
+/*
+ * push_batch - queue the batch the reader has filled for w, then wait
+ * for a free slot to fill next
+ */
+void push_batch(struct worker *w)
+{
+    pthread_mutex_lock(&w->lock);
+    w->len[w->tail] = w->nfill;
+    ++w->count;
+    pthread_cond_signal(&w->ready);
+    w->tail = (w->tail + 1) % QUEUE;
+    while (w->count == QUEUE)
+	pthread_cond_wait(&w->space, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+    w->nfill = 0;
+}
+
+/*
+ * touch_parallel - pass address visit to the thread owning its set
+ */
+void touch_parallel(unsigned long address)
+{
+    unsigned long set = (address >> blockbit) & set_mask;
+    struct worker *w = &workers[set * nthread / setnum];
+    w->batch[w->tail][w->nfill++] = address;
+    if (w->nfill == BATCH)
+	push_batch(w);
+}
+
+void start_workers()
+{
+    if (nthread > setnum)
+	nthread = setnum;
+    for (int i = 0; i < nthread; ++i) {
+	struct worker *w = &workers[i];
+	memset(w, 0, sizeof(*w));
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	pthread_cond_init(&w->space, NULL);
+	for (int k = 0; k < QUEUE; ++k)
+	    w->batch[k] = alloc_or_die(malloc(sizeof(unsigned long) * BATCH));
+	if (pthread_create(&w->tid, NULL, work, w) != 0) {
+	    printf("thread create failed");
+	    exit(-1);
+	}
+    }
+}
+
+/*
+ * finish_workers - queue the last batches, wait for the threads and
+ * add up their counts
+ */
+void finish_workers()
+{
+    for (int i = 0; i < nthread; ++i) {
+	struct worker *w = &workers[i];
+	if (w->nfill)
+	    push_batch(w);
+	pthread_mutex_lock(&w->lock);
+	w->done = 1;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->lock);
+    }
+    for (int i = 0; i < nthread; ++i) {
+	struct worker *w = &workers[i];
+	pthread_join(w->tid, NULL);
+	counts.hits += w->counts.hits;
+	counts.misses += w->counts.misses;
+	counts.evictions += w->counts.evictions;
+	for (int k = 0; k < QUEUE; ++k)
+	    free(w->batch[k]);
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->ready);
+	pthread_cond_destroy(&w->space);
+    }
+}
+
+/*
+ * stack groups - for -c, every configuration with the same s and b is
+ * answered by one group.  Under LRU a set holds the E most recently used
+ * of the blocks that map to it, so an access hits in an E-line cache
+ * exactly when its block is among the top E of the set's LRU stack.
+ * Each set keeps its stack down to the largest E of the group, and each
+ * access is counted by the depth where its block was found (hit_hist)
+ * or, if not found, by how many blocks were on the stack (miss_hist).
+ * For any E up to that depth, hits are the accesses found above depth
+ * E; a miss evicts when E blocks were above it, since only then was
+ * the set full
+ */
+struct group {
+    int s, b;
+    long depth;			/* largest E in the group */
+    unsigned long set_mask;
+    unsigned long *stack;	/* depth tags per set, most recent first */
+    long *fill;			/* blocks on each set's stack */
+    long *hit_hist;		/* [depth]: hits by depth */
+    long *miss_hist;		/* [depth + 1]: misses by blocks on stack */
+} groups[MAXCONFIG];
+int ngroup = 0;
+
+/*
+ * add_config - add configuration s, E, b to the -c list
+ */
+void add_config(int s, long E, int b)
+{
+    if (nconfig == MAXCONFIG || s < 0 || s > 30 || b < 0 || b > 63 || E < 1) {
+	printf("bad configuration %d,%ld,%d\n", s, E, b);
+	exit(1);
+    }
+    int g;
+    for (g = 0; g < ngroup; ++g)
+	if (groups[g].s == s && groups[g].b == b)
+	    break;
+    if (g == ngroup) {
+	groups[g].s = s;
+	groups[g].b = b;
+	groups[g].depth = 0;
+	++ngroup;
+    }
+    if (E > groups[g].depth)
+	groups[g].depth = E;
+    configs[nconfig].s = s;
+    configs[nconfig].E = E;
+    configs[nconfig].b = b;
+    configs[nconfig].group = g;
+    ++nconfig;
+}
+
+/*
+ * parse_configs - add the configurations "s,E,b ..." listed in arg
+ */
+void parse_configs(char *arg)
+{
+    char *p = arg, *q;
+    while (*p) {
+	while (*p == ' ' || *p == ';')
+	    ++p;
+	if (!*p)
+	    break;
+	long v[3];
+	for (int i = 0; i < 3; ++i) {
+	    v[i] = strtol(p, &q, 10);
+	    if (q == p || (i < 2 && *q != ','))
+		usage();
+	    p = q + (i < 2);
+	}
+	add_config(v[0], v[1], v[2]);
+    }
+}
+
+void init_groups()
+{
+    for (int g = 0; g < ngroup; ++g) {
+	struct group *gr = &groups[g];
+	long sets = 1L << gr->s;
+	gr->set_mask = sets - 1;
+	gr->stack = alloc_or_die(malloc(sizeof(unsigned long) * sets *
+					gr->depth));
+	gr->fill = alloc_or_die(calloc(sets, sizeof(long)));
+	gr->hit_hist = alloc_or_die(calloc(gr->depth, sizeof(long)));
+	gr->miss_hist = alloc_or_die(calloc(gr->depth + 1, sizeof(long)));
+    }
+}
+
+void free_groups()
+{
+    for (int g = 0; g < ngroup; ++g) {
+	free(groups[g].stack);
+	free(groups[g].fill);
+	free(groups[g].hit_hist);
+	free(groups[g].miss_hist);
+    }
+}
+
+/*
+ * touch_groups - simulate address visit in every group
+ */
+void touch_groups(unsigned long address)
+{
+    for (int g = 0; g < ngroup; ++g) {
+	struct group *gr = &groups[g];
+	unsigned long set = (address >> gr->b) & gr->set_mask;
+	unsigned long tag = (address >> gr->b) >> gr->s;
+	unsigned long *st = gr->stack + set * gr->depth;
+	long n = gr->fill[set];
+
+	/* move the block to the top of the stack */
+	long d = find_tag(st, n, tag);
+	if (d >= 0)
+	    ++gr->hit_hist[d];
+	else {
+	    ++gr->miss_hist[n];
+	    d = n < gr->depth ? n : gr->depth - 1;
+	    if (n < gr->depth)
+		gr->fill[set] = n + 1;
+	}
+	memmove(st + 1, st, d * sizeof(unsigned long));
+	st[0] = tag;
+    }
+}
+
+/*
+ * print_configs - print one summary row per -c configuration
+ */
+void print_configs()
+{
+    for (int i = 0; i < nconfig; ++i) {
+	struct config *c = &configs[i];
+	struct group *gr = &groups[c->group];
+	long hits = 0, misses = 0, evictions = 0;
+	for (long d = 0; d < gr->depth; ++d) {
+	    if (d < c->E)
+		hits += gr->hit_hist[d];
+	    else
+		misses += gr->hit_hist[d];
+	}
+	evictions = misses;
+	for (long n = 0; n <= gr->depth; ++n) {
+	    misses += gr->miss_hist[n];
+	    if (n >= c->E)
+		evictions += gr->miss_hist[n];
+	}
+	printf("s=%d E=%ld b=%d hits:%ld misses:%ld evictions:%ld\n",
+	       c->s, c->E, c->b, hits, misses, evictions);
+    }
+}
+
+/*
+ * hierarchy - for -H, a chain of caches below one or two L1 caches
+ * (data, and instruction with -I).  Each level keeps its own lines,
+ * with a dirty bit per line, and unlike the single cache its lines can
+ * be emptied again (by inclusion or exclusion), so empty lines are
+ * found by their zero stamp wherever they are.  Policies:
+ *   incl  a block evicted from a lower level is removed from the
+ *         levels above it
+ *   nine  each level fills on a miss, and evictions are not passed up
+ *   excl  a block lives in one level at a time: misses fill only the
+ *         L1, a lower level that hits gives its block up to the L1,
+ *         and blocks evicted from a level move down to the next one
+ * With write-back, stores dirty the L1 line and dirty victims are
+ * written to the next level (allocating there) or to memory.  With
+ * write-through, stores update each level that holds the block,
+ * allocate nowhere, and always reach memory
+ */
+#define MAXLEVEL 8
+
+enum { P_INCL, P_NINE, P_EXCL } inclusion = P_INCL;
+int write_through = 0;
+long mem_latency = 100;
 
-/* args */
-int verbose = 0;
-int setbit = 1;
-long setnum = 2;
-long linenum = 1;
-int blockbit = 1;
-char tracefile[MAXLINE];
+struct level {
+    char name[8];
+    int s, b;
+    long E, latency;
+    unsigned long set_mask;
+    unsigned long *tags;
+    unsigned long *stamps;
+    unsigned char *dirty;
+    unsigned long clock;
+    long accesses, hits, misses, evictions, writebacks;
+};
 
-/* result */
-int hit_count = 0;
-int miss_count = 0;
-int eviction_count = 0;
+struct level l1[2];		/* data, instruction */
+int split_l1 = 0;		/* -I given */
+int hier_options = 0;		/* -I, -P, -W or -M given */
+struct level lower[MAXLEVEL];	/* L2, L3, ... */
+int nlower = 0;
+int hierarchy = 0;		/* -H given */
+long mem_reads = 0, mem_writes = 0;
+unsigned long cycles = 0;	/* latency of all accesses, for AMAT */
+long level_refs = 0;		/* accesses made to the L1s */
 
-/* cache struct */
-struct cacheline {
-    int valid;
-    long tag;
-    unsigned long stamp;
+/* default latencies in cycles, by depth */
+static const long default_latency[MAXLEVEL + 1] = {
+    4, 12, 40, 80, 120, 160, 200, 240, 280
 };
-struct cacheline **cache = NULL;
 
 /*
- * usage - print help message
+ * parse_level - set up level c from "s,E,b[,latency]"
  */
-void usage() 
+void parse_level(struct level *c, char *spec, int depth)
 {
-    printf("Usage: shell [-hv] -s <s> -E <E> -b <b> -t <tracefile>\n");
-    printf("   -h   print this message\n");
-    printf("   -v   display trace info\n");
-    printf("   -s   number of set index bits\n");
-    printf("   -E   number of lines per set\n");
-    printf("   -b   number of block bits\n");
-    printf("   -t   name of the valgrind trace to replay\n");
-    exit(1);
+    long v[4];
+    int n = 0;
+    char *p = spec, *q;
+    while (n < 4) {
+	v[n] = strtol(p, &q, 10);
+	if (q == p)
+	    break;
+	++n;
+	if (*q != ',')
+	    break;
+	p = q + 1;
+    }
+    if (n < 3 || v[0] < 0 || v[0] > 30 || v[1] < 1 || v[2] < 0 || v[2] > 63) {
+	printf("bad cache level \"%s\"\n", spec);
+	exit(1);
+    }
+    c->s = v[0];
+    c->E = v[1];
+    c->b = v[2];
+    c->latency = n == 4 ? v[3] : default_latency[depth];
 }
 
 /*
- * init_cache - initialize the cache
+ * parse_hierarchy - set up L1D, L2, ... from "s,E,b[,lat] ..."
  */
-void init_cache()
+void parse_hierarchy(char *arg)
 {
-    /* malloc sets */
-    cache = malloc(sizeof(struct cacheline*) * setnum);
-    
-    /* malloc lines */
-    for (long i = 0; i < setnum; ++i) {
-	cache[i] = malloc(sizeof(struct cacheline) * linenum);
-
-	/* init lines */
-	for (long j = 0; j < linenum; ++j) {
-	    cache[i][j].valid = 0;
+    char *spec = strtok(arg, " ;");
+    if (!spec)
+	usage();
+    parse_level(&l1[0], spec, 0);
+    strcpy(l1[0].name, "L1D");
+    while ((spec = strtok(NULL, " ;")) != NULL) {
+	if (nlower == MAXLEVEL) {
+	    printf("at most %d levels below L1\n", MAXLEVEL);
+	    exit(1);
 	}
-    } 
+	parse_level(&lower[nlower], spec, nlower + 1);
+	sprintf(lower[nlower].name, "L%d", nlower + 2);
+	++nlower;
+    }
+    hierarchy = 1;
 }
 
-/* 
- * free_cache - free the cache
+void init_level(struct level *c)
+{
+    long lines = (1L << c->s) * c->E;
+    c->set_mask = (1UL << c->s) - 1;
+    c->tags = alloc_or_die(malloc(sizeof(unsigned long) * lines));
+    c->stamps = alloc_or_die(calloc(lines, sizeof(unsigned long)));
+    c->dirty = alloc_or_die(calloc(lines, 1));
+    for (long i = 0; i < lines; ++i)
+	c->tags[i] = EMPTY_TAG;
+}
+
+void free_level(struct level *c)
+{
+    free(c->tags);
+    free(c->stamps);
+    free(c->dirty);
+}
+
+/*
+ * lv_find - index of the line of c holding address, or -1
  */
-void free_cache()
+long lv_find(struct level *c, unsigned long address)
 {
-    /* free lines */
-    for (int i = 0; i < setnum; ++i) {
-	free(cache[i]);
+    long base = ((address >> c->b) & c->set_mask) * c->E;
+    unsigned long tag = (address >> c->b) >> c->s;
+    for (long i = base; i < base + c->E; ++i)
+	if (c->tags[i] == tag && c->stamps[i])
+	    return i;
+    return -1;
+}
+
+/*
+ * lv_fill - put the block holding address into c, empty or LRU line
+ * first.  Returns 1 and the victim's block address and dirty bit if a
+ * block was evicted
+ */
+int lv_fill(struct level *c, unsigned long address, int dirty,
+	    unsigned long *victim_addr, int *victim_dirty)
+{
+    unsigned long set = (address >> c->b) & c->set_mask;
+    long base = set * c->E, victim = base;
+    for (long i = base + 1; i < base + c->E; ++i)
+	if (c->stamps[i] < c->stamps[victim])
+	    victim = i;
+
+    int evicted = c->stamps[victim] != 0;
+    if (evicted) {
+	++c->evictions;
+	*victim_addr = ((c->tags[victim] << c->s | set) << c->b);
+	*victim_dirty = c->dirty[victim];
     }
+    c->tags[victim] = (address >> c->b) >> c->s;
+    c->stamps[victim] = ++c->clock;
+    c->dirty[victim] = dirty;
+    return evicted;
+}
+
+/*
+ * lv_remove - empty the line of c holding address, if any.  Returns 1
+ * if there was one, with its dirty bit
+ */
+int lv_remove(struct level *c, unsigned long address, int *dirty)
+{
+    long i = lv_find(c, address);
+    if (i < 0)
+	return 0;
+    *dirty = c->dirty[i];
+    c->tags[i] = EMPTY_TAG;
+    c->stamps[i] = 0;
+    c->dirty[i] = 0;
+    return 1;
+}
 
-    /* free sets */
-    free(cache);
+void put_block(unsigned long address, int dirty, int depth);
+
+/*
+ * back_invalidate - remove the block of size 1 << b at address from
+ * every level above lower[depth].  Returns 1 if any copy was dirty
+ */
+int back_invalidate(unsigned long address, int b, int depth)
+{
+    int any_dirty = 0, d = 0;
+    for (int k = -2; k < depth; ++k) {
+	struct level *c = k < 0 ? &l1[k + 2] : &lower[k];
+	if (k == -1 && !split_l1)
+	    continue;
+	for (unsigned long a = address; a < address + (1UL << b);
+	     a += 1UL << c->b)
+	    if (lv_remove(c, a, &d))
+		any_dirty |= d;
+    }
+    return any_dirty;
 }
 
 /*
- * touch - simulate address visit
+ * evicted - handle victim, a block evicted from c, where c is lower[depth]
+ * (depth -1 for an L1)
  */
-void touch(unsigned long address)
+void evicted(struct level *c, unsigned long victim, int dirty, int depth)
 {
-    /* simulate time stamp */
-    static unsigned long curr_stamp = 0;
-    ++curr_stamp;
+    if (inclusion == P_INCL && depth >= 0)
+	dirty |= back_invalidate(victim, c->b, depth);
+    if (dirty)
+	++c->writebacks;
+    if (inclusion == P_EXCL || dirty)
+	put_block(victim, dirty, depth + 1);
+}
 
-    /* split address */
-    long set = (address >> blockbit) & ((0x1ul << setbit) - 0x1);
-    long tag = address >> (setbit + blockbit);
-
-    /* find tag in corresponding set */
-    for (long i = 0; i < linenum; ++i) {
-	/* if hit, update stamp */
-	if (cache[set][i].valid && cache[set][i].tag == tag) {
-	    cache[set][i].stamp = curr_stamp;
-	    ++hit_count;
-	    return;
+/*
+ * put_block - write a block coming down from above into lower[depth]
+ * (or memory): a write-back, or under excl any victim
+ */
+void put_block(unsigned long address, int dirty, int depth)
+{
+    if (depth == nlower) {
+	if (dirty)
+	    ++mem_writes;
+	return;
+    }
+    struct level *c = &lower[depth];
+    long i = lv_find(c, address);
+    if (i >= 0) {
+	c->stamps[i] = ++c->clock;
+	c->dirty[i] |= dirty;
+	return;
+    }
+    unsigned long victim;
+    int victim_dirty;
+    if (lv_fill(c, address, dirty, &victim, &victim_dirty))
+	evicted(c, victim, victim_dirty, depth);
+}
+
+/*
+ * fetch - read the block holding address from lower[depth] (or memory)
+ * on a miss above.  Returns the dirty bit the block brings with it,
+ * which is only ever set under excl
+ */
+int fetch(unsigned long address, int depth)
+{
+    if (depth == nlower) {
+	++mem_reads;
+	cycles += mem_latency;
+	return 0;
+    }
+    struct level *c = &lower[depth];
+    cycles += c->latency;
+    ++c->accesses;
+    long i = lv_find(c, address);
+    if (i >= 0) {
+	++c->hits;
+	if (inclusion == P_EXCL) {
+	    int dirty = c->dirty[i];
+	    c->tags[i] = EMPTY_TAG;
+	    c->stamps[i] = 0;
+	    c->dirty[i] = 0;
+	    return dirty;
 	}
+	c->stamps[i] = ++c->clock;
+	return 0;
+    }
+    ++c->misses;
+    int dirty = fetch(address, depth + 1);
+    if (inclusion != P_EXCL) {
+	unsigned long victim;
+	int victim_dirty;
+	if (lv_fill(c, address, 0, &victim, &victim_dirty))
+	    evicted(c, victim, victim_dirty, depth);
     }
-    ++miss_count; /* else miss */ 
+    return dirty;
+}
 
-    /* find empty line */
-    for (long i = 0; i < linenum; ++i) {
-	/* if empty */
-        if (!cache[set][i].valid) {
-	    cache[set][i].valid = 1;
-	    cache[set][i].tag = tag;
-	    cache[set][i].stamp = curr_stamp;
-	    return;
+/*
+ * write_through_below - pass a store to every level below the L1 and memory
+ */
+void write_through_below(unsigned long address)
+{
+    for (int k = 0; k < nlower; ++k) {
+	struct level *c = &lower[k];
+	++c->accesses;
+	long i = lv_find(c, address);
+	if (i >= 0) {
+	    ++c->hits;
+	    c->stamps[i] = ++c->clock;
+	} else
+	    ++c->misses;
+    }
+    ++mem_writes;
+}
+
+/*
+ * hier_access - simulate a load or store (or with instr, an
+ * instruction fetch) in the hierarchy
+ */
+void hier_access(unsigned long address, int store, int instr)
+{
+    struct level *c = &l1[instr];
+    ++level_refs;
+    cycles += c->latency;
+    ++c->accesses;
+    long i = lv_find(c, address);
+    if (i >= 0) {
+	++c->hits;
+	c->stamps[i] = ++c->clock;
+	if (store && !write_through)
+	    c->dirty[i] = 1;
+	if (store && write_through)
+	    write_through_below(address);
+	return;
+    }
+    ++c->misses;
+    if (store && write_through) {
+	/* no write allocate */
+	write_through_below(address);
+	return;
+    }
+    int dirty = fetch(address, 0) | (store && !write_through);
+    unsigned long victim;
+    int victim_dirty;
+    if (lv_fill(c, address, dirty, &victim, &victim_dirty))
+	evicted(c, victim, victim_dirty, -1);
+}
+
+void init_hierarchy()
+{
+    if (split_l1)
+	strcpy(l1[1].name, "L1I");
+    for (int k = -2; k < nlower; ++k) {
+	struct level *c = k < 0 ? &l1[k + 2] : &lower[k];
+	if (k == -1 && !split_l1)
+	    continue;
+	/* a lower level's blocks must cover whole blocks above it */
+	int above = k <= 0 ? l1[0].b : lower[k - 1].b;
+	if (k == 0 && split_l1 && l1[1].b > above)
+	    above = l1[1].b;
+	if (k >= 0 && (c->b < above || (inclusion == P_EXCL && c->b != above))) {
+	    printf("%s blocks must be %s those above it\n", c->name,
+		   inclusion == P_EXCL ? "the same size as" : "at least as large as");
+	    exit(1);
+	}
+	init_level(c);
+    }
+}
+
+/*
+ * print_hierarchy - per-level counts and the average memory access time
+ */
+void print_hierarchy()
+{
+    printf("level  s   E  b  lat    accesses        hits      misses   evictions  writebacks  miss%%\n");
+    for (int k = -2; k < nlower; ++k) {
+	struct level *c = k < 0 ? &l1[k + 2] : &lower[k];
+	if (k == -1 && !split_l1)
+	    continue;
+	printf("%-5s %2d %3ld %2d %4ld %11ld %11ld %11ld %11ld %11ld %6.2f\n",
+	       c->name, c->s, c->E, c->b, c->latency, c->accesses, c->hits,
+	       c->misses, c->evictions, c->writebacks,
+	       c->accesses ? 100.0 * c->misses / c->accesses : 0.0);
+	free_level(c);
+    }
+    printf("memory reads:%ld writes:%ld latency:%ld\n", mem_reads, mem_writes,
+	   mem_latency);
+    printf("AMAT: %.2f cycles over %ld accesses\n",
+	   level_refs ? (double) cycles / level_refs : 0.0, level_refs);
+}
+
+/* binary trace being written */
+FILE *bin_out = NULL;
+unsigned char *bin_buf;
+long bin_len = 0;
+long bin_nrec = 0;
+long bin_bytes = 0;
+unsigned long bin_prev[2];
+
+static const char bin_ops[4] = { 'I', 'L', 'S', 'M' };
+
+void bin_put(char op, unsigned long address, int size);
+
+/* touch, or touch_groups for -c */
+void (*simulate)(unsigned long address) = touch;
+
+/*
+ * sized accesses - with -z an access covers size bytes, and touches
+ * every block it overlaps rather than just the one holding its first
+ * byte
+ */
+int size_aware = 0;
+long sized_accesses = 0;	/* accesses simulated */
+long line_touches = 0;		/* blocks they touched */
+long straddles = 0;		/* accesses touching more than one block */
+
+/*
+ * span - count the blocks of 1 << b bytes that size bytes at address
+ * overlap
+ */
+static inline long span(unsigned long address, int size, int b)
+{
+    unsigned long last = address + (size > 1 ? size - 1 : 0);
+    long n = (last >> b) - (address >> b) + 1;
+    ++sized_accesses;
+    line_touches += n;
+    if (n > 1)
+	++straddles;
+    return n;
+}
+
+/*
+ * simulate_sized - simulate an access of size bytes
+ */
+void simulate_sized(unsigned long address, int size)
+{
+    if (!size_aware) {
+	simulate(address);
+	return;
+    }
+    long n = span(address, size, blockbit);
+    for (long k = 0; k < n; ++k)
+	simulate(address + ((unsigned long) k << blockbit));
+}
+
+/*
+ * hier_sized - simulate an access of size bytes in the hierarchy
+ */
+void hier_sized(unsigned long address, int size, int store, int instr)
+{
+    if (!size_aware) {
+	hier_access(address, store, instr);
+	return;
+    }
+    int b = l1[instr].b;
+    long n = span(address, size, b);
+    for (long k = 0; k < n; ++k)
+	hier_access(address + ((unsigned long) k << b), store, instr);
+}
+
+/*
+ * print_sizes - report how accesses fell across blocks, with -z
+ */
+void print_sizes(void)
+{
+    if (!size_aware)
+	return;
+    printf("accesses:%ld line touches:%ld straddling:%ld (%.2f%%)\n",
+	   sized_accesses, line_touches, straddles,
+	   sized_accesses ? 100.0 * straddles / sized_accesses : 0.0);
+}
+
+/*
+ * record - handle one trace record
+ */
+void record(char op, unsigned long address, int size)
+{
+    ++record_count;
+    if (parse_rounds)
+	return;
+    if (bin_out) {
+	bin_put(op, address, size);
+	return;
+    }
+    if (hierarchy) {
+	switch (op) {
+	case 'I':
+	    if (split_l1)
+		hier_sized(address, size, 0, 1);
+	    break;
+	case 'M':
+	    hier_sized(address, size, 0, 0);
+	    hier_sized(address, size, 1, 0);
+	    break;
+	case 'L':
+	case 'S':
+	    hier_sized(address, size, op == 'S', 0);
+	    break;
 	}
+	return;
     }
-    ++eviction_count;/* else eviction */
+    switch (op) {
+    case 'M':			/* if modify, touch twice */
+	simulate_sized(address, size);
+    case 'L':
+    case 'S':			/* if load or store, touch once */
+	simulate_sized(address, size);
+	break;
+    default:			/* else(op == 'I'), ignore */
+	break;
+    }
+}
 
-    /* find least recently used line */
-    unsigned long min_stamp = curr_stamp; 
-    long evic_line = 0;
-    for (long i = 0; i < linenum; ++i) {
-	if (cache[set][i].stamp < min_stamp) {
-	    min_stamp = cache[set][i].stamp;
-	    evic_line = i;
+/* hex digit values, -1 for other characters */
+static signed char hexval[256];
+
+static void init_hexval()
+{
+    static int done = 0;
+    if (done)
+	return;
+    done = 1;
+    memset(hexval, -1, sizeof(hexval));
+    for (int i = 0; i < 10; ++i)
+	hexval['0' + i] = i;
+    for (int i = 0; i < 6; ++i)
+	hexval['a' + i] = hexval['A' + i] = 10 + i;
+}
+
+/*
+ * parse_lines - parse the complete lines in buf[0..len), calling
+ * record() for each.  A line is " op address,size" (op 'I' has no
+ * leading space).  If last is set, the text ends at len even without
+ * a newline.  Returns the number of bytes used, which stops short of
+ * a trailing partial line, or -1 at a malformed line (unless
+ * converting, when those are skipped)
+ */
+long parse_lines(const char *buf, long len, int last)
+{
+    const char *p = buf, *end = buf + len;
+
+    while (p < end) {
+	const char *nl = memchr(p, '\n', end - p);
+	if (!nl) {
+	    if (!last)
+		break;
+	    nl = end;
 	}
+
+	/* op, after any leading blanks; skip empty lines */
+	while (p < nl && (*p == ' ' || *p == '\t' || *p == '\r'))
+	    ++p;
+	if (p == nl) {
+	    p = nl + 1;
+	    continue;
+	}
+	char op = *p++;
+
+	/* hex address */
+	while (p < nl && *p == ' ')
+	    ++p;
+	unsigned long address = 0;
+	const char *digits = p;
+	int d;
+	while (p < nl && (d = hexval[(unsigned char) *p]) >= 0) {
+	    address = (address << 4) | d;
+	    ++p;
+	}
+	if (p == digits || p == nl || *p != ',')
+	    goto bad;
+	++p;
+
+	/* decimal size */
+	int size = 0;
+	digits = p;
+	while (p < nl && *p >= '0' && *p <= '9')
+	    size = size * 10 + (*p++ - '0');
+	if (p == digits)
+	    goto bad;
+
+	record(op, address, size);
+	p = nl + 1;
+	continue;
+
+    bad:
+	/* lackey's own output has other lines, which -w passes over */
+	if (!bin_out)
+	    return -1;
+	p = nl + 1;
     }
+    return (p < end ? p : end) - buf;
+}
+
+/* little-endian 32-bit field */
+static unsigned long get32(const unsigned char *p)
+{
+    return p[0] | (p[1] << 8) | ((unsigned long) p[2] << 16) |
+	((unsigned long) p[3] << 24);
+}
+
+static void put32(unsigned char *p, unsigned long v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static unsigned char *put_varint(unsigned char *p, unsigned long v)
+{
+    while (v >= 0x80) {
+	*p++ = (v & 0x7f) | 0x80;
+	v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/*
+ * bin_flush - write out the block being built
+ */
+void bin_flush()
+{
+    if (bin_nrec == 0)
+	return;
+    put32(bin_buf, bin_nrec);
+    put32(bin_buf + 4, bin_len - 8);
+    fwrite(bin_buf, 1, bin_len, bin_out);
+    bin_bytes += bin_len;
+    bin_len = 8;
+    bin_nrec = 0;
+    bin_prev[0] = bin_prev[1] = 0;
+}
+
+/*
+ * bin_put - add a record to the binary trace
+ */
+void bin_put(char op, unsigned long address, int size)
+{
+    int code;
+    switch (op) {
+    case 'I': code = 0; break;
+    case 'L': code = 1; break;
+    case 'S': code = 2; break;
+    case 'M': code = 3; break;
+    default: return;		/* csim ignores anything else anyway */
+    }
+
+    unsigned char *p = bin_buf + bin_len;
+    if (size >= 0 && size < 63)
+	*p++ = code | (size << 2);
+    else {
+	*p++ = code | (63 << 2);
+	p = put_varint(p, (unsigned int) size);
+    }
+    long delta = address - bin_prev[code != 0];
+    bin_prev[code != 0] = address;
+    p = put_varint(p, ((unsigned long) delta << 1) ^ (delta >> 63));
+    bin_len = p - bin_buf;
+
+    if (++bin_nrec == BIN_BLOCK)
+	bin_flush();
+}
+
+/*
+ * parse_blocks - decode the complete blocks of a binary trace in
+ * buf[0..len), calling record() for each record.  Returns the number
+ * of bytes used, or -1 if a block is malformed
+ */
+long parse_blocks(const unsigned char *buf, long len)
+{
+    const unsigned char *p = buf, *end = buf + len;
+
+    while (end - p >= 8) {
+	unsigned long nrec = get32(p), nbytes = get32(p + 4);
+	if (nrec > BIN_BLOCK || nbytes > BIN_BLOCK * BIN_RECORD_MAX)
+	    return -1;
+	if ((unsigned long) (end - p - 8) < nbytes)
+	    break;
+	p += 8;
+
+	const unsigned char *bend = p + nbytes;
+	unsigned long prev[2] = { 0, 0 };
+	for (unsigned long i = 0; i < nrec; ++i) {
+	    unsigned long v;
+	    int shift;
 
-    /* replace the evicted line */
-    cache[set][evic_line].tag = tag;
-    cache[set][evic_line].stamp = curr_stamp;
+	    if (p >= bend)
+		return -1;
+	    int code = *p & 3;
+	    int size = *p++ >> 2;
+	    if (size == 63) {
+		for (v = 0, shift = 0; p < bend && (*p & 0x80) && shift < 63;
+		     shift += 7)
+		    v |= (unsigned long) (*p++ & 0x7f) << shift;
+		if (p == bend)
+		    return -1;
+		size = v | (unsigned long) *p++ << shift;
+	    }
+	    for (v = 0, shift = 0; p < bend && (*p & 0x80) && shift < 63;
+		     shift += 7)
+		v |= (unsigned long) (*p++ & 0x7f) << shift;
+	    if (p == bend)
+		return -1;
+	    v |= (unsigned long) *p++ << shift;
+	    prev[code != 0] += (v >> 1) ^ -(v & 1);
+	    record(bin_ops[code], prev[code != 0], size);
+	}
+	p = bend;
+    }
+    return p - buf;
 }
 
 /*
- * parse_trace - parse trace and get counts 
+ * parse_trace - parse trace and get counts.  The trace is mapped into
+ * memory and decoded by hand, which is many times faster than fscanf;
+ * files that cannot be mapped (pipes, say) are read a block at a time.
+ * Binary traces are recognized by their first bytes
  */
 void parse_trace()
 {
     /* open file */
-    FILE *file = fopen(tracefile, "r");
-    if (!file) {
+    int fd = open(tracefile, O_RDONLY);
+    if (fd < 0) {
 	printf("file open failed");
 	exit(-1);
     }
+    init_hexval();
 
-    /* trace line args */
-    char op;
-    unsigned long address;
-    int size;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map != MAP_FAILED) {
+	    posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+	    if (st.st_size >= BIN_MAGIC_LEN &&
+		memcmp(map, BIN_MAGIC, BIN_MAGIC_LEN) == 0)
+		parse_blocks((unsigned char *) map + BIN_MAGIC_LEN,
+			     st.st_size - BIN_MAGIC_LEN);
+	    else
+		parse_lines(map, st.st_size, 1);
+	    munmap(map, st.st_size);
+	    close(fd);
+	    return;
+	}
+    }
 
-    /* read each line */
-    while (fscanf(file, " %c %lx,%d\n", &op, &address, &size) == 3) {
-	switch (op) {
-	case 'M':		/* if modify, touch twice */
-	    touch(address);
-	case 'L':
-	case 'S':		/* if load or store, touch once */
-	    touch(address);
-	    break;
-	default:		/* else(op == 'I'), ignore */
-	    continue;
+    /* read blocks, carrying a partial last line (or binary block) over
+       to the next one */
+    char *buf = alloc_or_die(malloc(READ_BLOCK + MAXLINE));
+    long len = 0, n, used;
+    int binary = -1;		/* not known until BIN_MAGIC_LEN bytes */
+    while ((n = read(fd, buf + len, READ_BLOCK + MAXLINE - len)) > 0) {
+	len += n;
+	used = 0;
+	if (binary < 0 && len >= BIN_MAGIC_LEN) {
+	    binary = memcmp(buf, BIN_MAGIC, BIN_MAGIC_LEN) == 0;
+	    used = binary ? BIN_MAGIC_LEN : 0;
 	}
+	if (binary == 1)
+	    n = parse_blocks((unsigned char *) buf + used, len - used);
+	else if (binary == 0)
+	    n = parse_lines(buf, len, 0);
+	else
+	    n = 0;		/* keep it all until the format is known */
+	if (n < 0)
+	    break;
+	used += n;
+	memmove(buf, buf + used, len - used);
+	len -= used;
+	if (len == READ_BLOCK + MAXLINE) /* line too long */
+	    break;
     }
+    if (n == 0 && len > 0 && binary != 1)
+	parse_lines(buf, len, 1);
+    free(buf);
 
     /* close file */
-    fclose(file);
+    close(fd);
+}
+
+/*
+ * convert_trace - write the trace to binfile in binary form
+ */
+void convert_trace()
+{
+    bin_out = fopen(binfile, "wb");
+    if (!bin_out) {
+	printf("file open failed");
+	exit(-1);
+    }
+    bin_buf = alloc_or_die(malloc(8 + BIN_BLOCK * BIN_RECORD_MAX));
+    bin_len = 8;
+    fwrite(BIN_MAGIC, 1, BIN_MAGIC_LEN, bin_out);
+    bin_bytes = BIN_MAGIC_LEN;
+
+    parse_trace();
+    bin_flush();
+
+    if (fclose(bin_out) != 0) {
+	printf("file write failed");
+	exit(-1);
+    }
+    free(bin_buf);
+    printf("%ld records written to %s (%ld bytes)\n", record_count, binfile,
+	   bin_bytes);
+}
+
+/*
+ * bench_parse - parse the trace parse_rounds times and report the rate
+ */
+void bench_parse()
+{
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < parse_rounds; ++i)
+	parse_trace();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+    printf("%ld lines in %.3f s: %.1f M lines/s\n", record_count, secs,
+	   secs > 0 ? record_count / secs * 1e-6 : 0.0);
 }
 
 /*
@@ -179,7 +1980,7 @@ int main(int argc, char **argv)
 
     /* parse the command line */
     char c;
-    while ((c = getopt(argc, argv, "hvs:E:b:t:")) != EOF) {
+    while ((c = getopt(argc, argv, "hvzs:E:b:t:p:w:c:j:r:y:R:H:I:P:W:M:")) != EOF) {
         switch (c) {
         case 'h':		/* print help message */  
 	    usage();
@@ -204,27 +2005,171 @@ int main(int argc, char **argv)
 	    strcpy(tracefile, optarg);
 	    f_trace = 1;
 	    break;
+	case 'p':			/* parser benchmark */
+	    parse_rounds = atoi(optarg);
+	    break;
+	case 'w':			/* convert to binary */
+	    strcpy(binfile, optarg);
+	    break;
+	case 'c':			/* configurations to sweep */
+	    parse_configs(optarg);
+	    break;
+	case 'z':			/* size-aware accesses */
+	    size_aware = 1;
+	    break;
+	case 'r':			/* miss report */
+	    report_pairs = atoi(optarg);
+	    if (report_pairs < 1)
+		usage();
+	    break;
+	case 'y':			/* symbols for the report */
+	    strcpy(symfile, optarg);
+	    break;
+	case 'R':			/* replacement policy */
+	    set_policy(optarg);
+	    break;
+	case 'H':			/* cache hierarchy */
+	    parse_hierarchy(optarg);
+	    break;
+	case 'I':			/* separate L1 instruction cache */
+	    parse_level(&l1[1], optarg, 0);
+	    split_l1 = 1;
+	    hier_options = 1;
+	    break;
+	case 'P':			/* inclusion policy */
+	    if (strcmp(optarg, "incl") == 0)
+		inclusion = P_INCL;
+	    else if (strcmp(optarg, "nine") == 0)
+		inclusion = P_NINE;
+	    else if (strcmp(optarg, "excl") == 0)
+		inclusion = P_EXCL;
+	    else
+		usage();
+	    hier_options = 1;
+	    break;
+	case 'W':			/* write policy */
+	    if (strcmp(optarg, "wb") == 0 || strcmp(optarg, "wt") == 0)
+		write_through = optarg[1] == 't';
+	    else
+		usage();
+	    hier_options = 1;
+	    break;
+	case 'M':			/* memory latency */
+	    mem_latency = atol(optarg);
+	    hier_options = 1;
+	    break;
+	case 'j':			/* simulating threads */
+	    nthread = atoi(optarg);
+	    if (nthread < 1 || nthread > MAXTHREAD)
+		usage();
+	    break;
 	default:
             usage();
 	}
     }
 
     /* if arg missing */
-    if (!f_set || !f_line || !f_block || !f_trace) {
+    if (!f_trace || (!parse_rounds && !binfile[0] && !nconfig && !hierarchy &&
+		     (!f_set || !f_line || !f_block || linenum < 1))) {
+	usage();
+    }
+
+    /* parser benchmark only */
+    if (parse_rounds > 0) {
+	bench_parse();
+	return 0;
+    }
+
+    /* conversion only */
+    if (binfile[0]) {
+	convert_trace();
+	return 0;
+    }
+
+    /* policy limits */
+    if (policy != &policies[0] && (nthread > 1 || nconfig || hierarchy)) {
+	printf("-j, -c and -H simulate LRU only\n");
+	exit(1);
+    }
+    if (nthread > 1 && (nconfig || hierarchy))
+	usage();
+    if (report_pairs && (nthread > 1 || nconfig || hierarchy)) {
+	printf("-r reports on a single cache, without -j, -c or -H\n");
+	exit(1);
+    }
+    if (symfile[0] && !report_pairs)
+	usage();
+    if (hier_options && !hierarchy)
 	usage();
+    if (size_aware && nconfig) {
+	printf("-z needs a single block size, and -c sweeps several\n");
+	exit(1);
+    }
+
+    /* cache hierarchy */
+    if (hierarchy) {
+	init_hierarchy();
+	parse_trace();
+	print_hierarchy();
+	print_sizes();
+	return 0;
+    }
+
+    /* all configurations in one pass */
+    if (nconfig) {
+	init_groups();
+	simulate = touch_groups;
+	parse_trace();
+	print_configs();
+	free_groups();
+	return 0;
+    }
+
+    if (strcmp(policy->name, "plru") == 0) {
+	for (plru_levels = 0; (1L << plru_levels) < linenum; ++plru_levels)
+	    ;
+	if ((1L << plru_levels) != linenum || linenum > 64) {
+	    printf("plru needs E to be a power of 2 up to 64\n");
+	    exit(1);
+	}
     }
 
     /* init cache */
     init_cache();
+    if (report_pairs) {
+	init_report();
+	reported = policy == &policies[0] ? touch : touch_other;
+    }
 
     /* parse trace */
-    parse_trace();
+    if (strcmp(policy->name, "opt") == 0) {
+	simulate = opt_collect;
+	parse_trace();
+	opt_run();
+    } else if (report_pairs) {
+	simulate = touch_reported;
+	parse_trace();
+    } else if (policy != &policies[0]) {
+	simulate = touch_other;
+	parse_trace();
+    } else if (nthread > 1) {
+	start_workers();
+	simulate = touch_parallel;
+	parse_trace();
+	finish_workers();
+    } else
+	parse_trace();
 
     /* free cache */
     free_cache();
 
     /* print result */
-    printSummary(hit_count, miss_count, eviction_count);
+    printSummary(counts.hits, counts.misses, counts.evictions);
+    print_sizes();
+    if (report_pairs) {
+	print_report();
+	free_report();
+    }
 
     return 0;
 }
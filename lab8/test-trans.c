@@ -3,6 +3,8 @@
  *     student's transpose functions and records the results for their
  *     official submitted version as well.
  */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -12,7 +14,7 @@
 #include <getopt.h>
 #include <sys/types.h>
 #include "cachelab.h"
-#include <sys/wait.h> // fir WEXITSTATUS
+#include <sys/wait.h> // for waitpid
 #include <limits.h> // for INT_MAX
 
 /* Maximum array dimension */
@@ -32,6 +34,18 @@ extern int func_counter;
 /* Globals set on the command line */
 static int M = 0;
 static int N = 0;
+static int write_traces = 0;        /* -t: write trace.fN */
+
+/* Child process running a transpose function, if any */
+static pid_t child = 0;
+
+/* The matrices, laid out as in tracegen: A on a cache block boundary
+   and B right after it, so that the two map to the cache as they did in
+   the valgrind traces */
+static struct {
+    int A[MAXN][MAXN];
+    int B[MAXN][MAXN];
+} mat __attribute__((aligned(64)));
 
 /* The correctness and performance for the submitted transpose function */
 struct results {
@@ -41,22 +55,177 @@ struct results {
 };
 static struct results results = {-1, 0, INT_MAX};
 
+/*
+ * The simulated cache.  The Makefile builds trans.c for test-trans with
+ * -fsanitize=kernel-address, which makes every load and store in it
+ * call one of the __asan_* functions below with the address.  They
+ * feed the cache directly while a transpose function runs, in place of
+ * tracing tracegen under valgrind and replaying the trace with csim-ref.
+ * This needs gcc (see the Makefile).  With -t the accesses also go to
+ * trace.fN, for replaying with csim-ref -v
+ */
+static int tracing = 0;             /* is a transpose function running? */
+static unsigned long stack_top;     /* its caller's frame */
+static FILE *trace_fp;
+static unsigned int sim_s, sim_E, sim_b;
+static unsigned long *sim_tags, *sim_stamps, sim_clock;
+static unsigned int sim_hits, sim_misses, sim_evictions;
+
+/* 
+ * sim_access - Simulate an access of size bytes at p, on an LRU cache
+ */
+static inline void sim_access(const void *p, char op, long size)
+{
+    unsigned long addr = (unsigned long) p;
+    unsigned long block, tag, *t, *st;
+    unsigned int i, victim = 0;
+
+    if (!tracing)
+        return;
+
+    /* The valgrind traces left out the stack, which lies between the
+       hook's frame and the caller of the transpose function */
+    if (addr >= (unsigned long) __builtin_frame_address(0) && 
+        addr < stack_top)
+        return;
+
+    block = addr >> sim_b;
+    tag = block >> sim_s;
+    t = sim_tags + (block & ((1ul << sim_s) - 1)) * sim_E;
+    st = sim_stamps + (block & ((1ul << sim_s) - 1)) * sim_E;
+    sim_clock++;
+    for (i = 0; i < sim_E; i++) {
+        if (st[i] && t[i] == tag) {
+            st[i] = sim_clock;
+            sim_hits++;
+            break;
+        }
+        if (st[i] < st[victim])
+            victim = i;
+    }
+    if (i == sim_E) {
+        sim_misses++;
+        if (st[victim])
+            sim_evictions++;
+        t[victim] = tag;
+        st[victim] = sim_clock;
+    }
+    if (trace_fp)
+        fprintf(trace_fp, " %c %lx,%ld\n", op, addr, size);
+}
+
+/* Hooks called by the instrumented trans.c */
+#define SIM_HOOKS(n) \
+    void __asan_load##n##_noabort(void *p) { sim_access(p, 'L', n); } \
+    void __asan_store##n##_noabort(void *p) { sim_access(p, 'S', n); }
+SIM_HOOKS(1)
+SIM_HOOKS(2)
+SIM_HOOKS(4)
+SIM_HOOKS(8)
+SIM_HOOKS(16)
+void __asan_loadN_noabort(void *p, long n) { sim_access(p, 'L', n); }
+void __asan_storeN_noabort(void *p, long n) { sim_access(p, 'S', n); }
+void __asan_handle_no_return(void) { }
+
+/*
+ * driver_accesses - Simulate the accesses that tracegen itself made
+ *     between its markers, before (end = 0) or after (end = 1) calling
+ *     function fn: the start marker store, the load of the function
+ *     pointer and of M and N, and the end marker store.  They are put
+ *     where they were in tracegen, just after B, so that the counts
+ *     match those of the valgrind traces the lab's thresholds were set
+ *     against
+ */
+static void driver_accesses(int fn, int end)
+{
+    char *after = (char *) (mat.B + MAXN);
+
+    if (end) {
+        sim_access(after + 0xd, 'S', 1);
+        return;
+    }
+    sim_access(after + 0xc, 'S', 1);
+    sim_access(after + 0x20 + fn * sizeof(trans_func_t), 'L', 8);
+    sim_access(after + 4, 'L', 4);
+    sim_access(after, 'L', 4);
+}
+
+/*
+ * validate - Check that B is the transpose of A
+ */
+int validate(int fn, int M, int N, int A[N][M], int B[M][N])
+{
+    int C[M][N];
+    memset(C, 0, sizeof(C));
+    correctTrans(M, N, A, C);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            if (B[i][j] != C[i][j]) {
+                printf("Validation failed on function %d! Expected %d but got %d at B[%d][%d]\n", fn, C[i][j], B[i][j], i, j);
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/* What the child running a transpose function reports */
+struct outcome {
+    int correct;
+    unsigned int hits, misses, evictions;
+};
+
+/*
+ * run_func - Run transpose function i on the simulated cache and check
+ *     it.  Called in a child process, so that a crash only ends that
+ */
+static void run_func(int i, struct outcome *out)
+{
+    char filename[128];
+    static char trace_buf[1 << 16];
+
+    if (write_traces) {
+        /* Each function's accesses go in a separate trace file */
+        sprintf(filename, "trace.f%d", i);
+        trace_fp = fopen(filename, "w");
+        assert(trace_fp);
+        setvbuf(trace_fp, trace_buf, _IOFBF, sizeof(trace_buf));
+    }
+
+    initMatrix(M, N, mat.A, mat.B);
+    stack_top = (unsigned long) __builtin_frame_address(0);
+    tracing = 1;
+    driver_accesses(i, 0);
+    (*func_list[i].func_ptr)(M, N, mat.A, mat.B);
+    driver_accesses(i, 1);
+    tracing = 0;
+    if (trace_fp)
+        fclose(trace_fp);
+
+    printf("Step 2: Validating\n");
+    out->correct = validate(i, M, N, mat.A, mat.B);
+    out->hits = sim_hits;
+    out->misses = sim_misses;
+    out->evictions = sim_evictions;
+}
+
 /* 
  * eval_perf - Evaluate the performance of the registered transpose functions
  */
 void eval_perf(unsigned int s, unsigned int E, unsigned int b)
 {
-    int i,flag;
-    unsigned int len, hits, misses, evictions;
-    unsigned long long int marker_start, marker_end, addr;
-    char buf[1000], cmd[255];
-    char filename[128];
+    int i, fd[2], status;
+    unsigned long lines = (1ul << s) * E;
+    struct outcome out;
 
     registerFunctions(); 
 
-    /* Open the complete trace file */
-    FILE* full_trace_fp;  
-    FILE* part_trace_fp; 
+    sim_s = s;
+    sim_E = E;
+    sim_b = b;
+    sim_tags = malloc(lines * sizeof(unsigned long));
+    sim_stamps = calloc(lines, sizeof(unsigned long));
+    assert(sim_tags && sim_stamps);
 
     /* Evaluate the performance of each registered transpose function */
 
@@ -65,22 +234,42 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.funcid = i; /* remember which function is the submission */
 
 
-        printf("\nFunction %d (%d total)\nStep 1: Validating and generating memory traces\n",i,func_counter);
-        /* Use valgrind to generate the trace */
+        printf("\nFunction %d (%d total)\nStep 1: Running the function on a simulated cache (s=%d, E=%d, b=%d)\n",i,func_counter, s, E, b);
 
-        sprintf(cmd, "valgrind --tool=lackey --trace-mem=yes --log-fd=1 -v ./tracegen -M %d -N %d -F %d  > trace.tmp", M, N,i);
-        flag=WEXITSTATUS(system(cmd));
-        if (0!=flag) {
-            printf("Validation error at function %d! Run ./tracegen -M %d -N %d -F %d for details.\nSkipping performance evaluation for this function.\n",flag-1,M,N,i);      
+        /* Run it in a child, which starts from a cold cache */
+        fflush(stdout);
+        if (pipe(fd) < 0 || (child = fork()) < 0) {
+            perror("test-trans");
+            exit(1);
+        }
+        if (child == 0) {
+            close(fd[0]);
+            signal(SIGSEGV, SIG_DFL);
+            run_func(i, &out);
+            if (write(fd[1], &out, sizeof(out)) != sizeof(out))
+                perror("test-trans");
+            fflush(stdout);
+            _exit(0);
+        }
+        close(fd[1]);
+        if (read(fd[0], &out, sizeof(out)) != sizeof(out))
+            out.correct = -1;
+        close(fd[0]);
+        waitpid(child, &status, 0);
+        child = 0;
+
+        if (out.correct < 0) {
+            if (WIFSIGNALED(status))
+                printf("Function %d crashed with signal %d\n", i, WTERMSIG(status));
+            else
+                printf("Function %d exited without finishing\n", i);
+            printf("Skipping performance evaluation for this function.\n");
+            continue;
+        }
+        if (!out.correct) {
+            printf("Validation error at function %d!\nSkipping performance evaluation for this function.\n", i);
             continue;
         }
-
-        /* Get the start and end marker addresses */
-        FILE* marker_fp = fopen(".marker", "r");
-        assert(marker_fp);
-        fscanf(marker_fp, "%llx %llx", &marker_start, &marker_end);
-        fclose(marker_fp);
-
 
         func_list[i].correct=1;
 
@@ -89,86 +278,32 @@ void eval_perf(unsigned int s, unsigned int E, unsigned int b)
             results.correct = 1;
         }
 
-        full_trace_fp = fopen("trace.tmp", "r");
-        assert(full_trace_fp);
-
-
-        /* Filtered trace for each transpose function goes in a separate file */
-        sprintf(filename, "trace.f%d", i);
-        part_trace_fp = fopen(filename, "w");
-        assert(part_trace_fp);
-    
-        /* Locate trace corresponding to the trans function */
-        flag = 0;
-        while (fgets(buf, 1000, full_trace_fp) != NULL) {
-
-            /* We are only interested in memory access instructions */
-            if (buf[0]==' ' && buf[2]==' ' &&
-                (buf[1]=='S' || buf[1]=='M' || buf[1]=='L' )) {
-                sscanf(buf+3, "%llx,%u", &addr, &len);
-        
-                /* If start marker found, set flag */
-                if (addr == marker_start)
-                    flag = 1;
-
-                /* Valgrind creates many spurious accesses to the
-                   stack that have nothing to do with the students
-                   code. At the moment, we are ignoring all stack
-                   accesses by using the simple filter of recording
-                   accesses to only the low 32-bit portion of the
-                   address space. At some point it would be nice to
-                   try to do more informed filtering so that would
-                   eliminate the valgrind stack references while
-                   include the student stack references. */
-                if (flag && addr < 0xffffffff) {
-                    fputs(buf, part_trace_fp);
-                }
-
-                /* if end marker found, close trace file */
-                if (addr == marker_end) {
-                    flag = 0;
-                    fclose(part_trace_fp);
-                    break;
-                }
-            }
-        }
-        fclose(full_trace_fp);
-
-        /* Run the reference simulator */
-        printf("Step 2: Evaluating performance (s=%d, E=%d, b=%d)\n", s, E, b);
-        char cmd[255];
-        sprintf(cmd, "./csim-ref -s %u -E %u -b %u -t trace.f%d > /dev/null", 
-                s, E, b, i);
-        system(cmd);
-    
-        /* Collect results from the reference simulator */
-        FILE* in_fp = fopen(".csim_results","r");
-        assert(in_fp);
-        fscanf(in_fp, "%u %u %u", &hits, &misses, &evictions);
-        fclose(in_fp);
-        func_list[i].num_hits = hits;
-        func_list[i].num_misses = misses;
-        func_list[i].num_evictions = evictions;
+        func_list[i].num_hits = out.hits;
+        func_list[i].num_misses = out.misses;
+        func_list[i].num_evictions = out.evictions;
         printf("func %u (%s): hits:%u, misses:%u, evictions:%u\n",
-               i, func_list[i].description, hits, misses, evictions);
+               i, func_list[i].description, out.hits, out.misses, out.evictions);
     
         /* If it is transpose_submit(), record number of misses */
         if (results.funcid == i) {
-            results.misses = misses;
+            results.misses = out.misses;
         }
     }
-  
+
+    free(sim_tags);
+    free(sim_stamps);
 }
 
 /*
  * usage - Print usage info
  */
 void usage(char *argv[]){
-    printf("Usage: %s [-h] -M <rows> -N <cols>\n", argv[0]);
+    printf("Usage: %s [-ht] -M <rows> -N <cols>\n", argv[0]);
     printf("Options:\n");
     printf("  -h          Print this help message.\n");
     printf("  -M <rows>   Number of matrix rows (max %d)\n", MAXN);
     printf("  -N <cols>   Number of  matrix columns (max %d)\n", MAXN);
+    printf("  -t          Write the accesses of function N to trace.fN\n");
     printf("Example: %s -M 8 -N 8\n", argv[0]);       
 }
 
@@ -186,6 +321,8 @@ void sigsegv_handler(int signum){
  * sigalrm_handler - SIGALRM handler
  */
 void sigalrm_handler(int signum){
+    if (child > 0)
+        kill(child, SIGKILL);
     printf("Error: Program timed out.\n");
     printf("TEST_TRANS_RESULTS=0:0\n");
     fflush(stdout);
@@ -199,7 +336,7 @@ int main(int argc, char* argv[])
 {
     char c;
 
-    while ((c = getopt(argc,argv,"M:N:h")) != -1) {
+    while ((c = getopt(argc,argv,"M:N:ht")) != -1) {
         switch(c) {
         case 'M':
             M = atoi(optarg);
@@ -207,6 +344,9 @@ int main(int argc, char* argv[])
         case 'N':
             N = atoi(optarg);
             break;
+        case 't':
+            write_traces = 1;
+            break;
         case 'h':
             usage(argv);
             exit(0);